@@ -0,0 +1,299 @@
+/** @file
+	Contains the expression compiler, which is used by the main 
+	thread to turn each operation line into a single operation.<br>
+	Expressions are made of numbers, the binary operators 
+	<tt>+ - * /</tt> with the usual precedence, unary minus and 
+	parentheses. Numbers are read in the type of the operation: 
+	integers for the integer types, decimals for floating point.
+	An expression with a single binary operator between two numbers
+	becomes a plain operation; the others are compiled into 
+	bytecode, which is stored in an arena and evaluated by the 
+	processors.<br>
+	For details on arenas, see @ref expr_arena.
+*/
+
+#include <ctype.h>
+#include <stdlib.h>
+#include "expr.h"
+#include "io_utils.h"
+
+/** 
+	@brief A block of bytecode instructions.
+	@see expr_arena
+*/
+typedef struct arena_chunk {
+	/// The next chunk, @c NULL if last
+	struct arena_chunk *next;
+
+	/// The number of used instructions
+	int used;
+
+	/// The number of available instructions
+	int capacity;
+
+	/// The instructions
+	int64_t code[];
+} arena_chunk;
+
+/**
+	Represents an arena: a list of chunks which are never moved, so
+	that compiled expressions can be referenced by pointer.
+*/
+struct expr_arena {
+	/// The chunk instructions are currently allocated from
+	arena_chunk *head;
+};
+
+/// The state of the compilation of an expression.
+typedef struct compiler {
+	/// The next character to parse
+	char *pos;
+
+	/// The type of the expression
+	value_type type;
+
+	/// The emitted instructions
+	int64_t code[EXPR_MAX_CODE];
+
+	/// The number of emitted instructions
+	int length;
+
+	/// The current stack depth
+	int depth;
+
+	/// Nonzero if an error occurred
+	int error;
+} compiler;
+
+static void emit(compiler *const c, int opcode);
+static void emit_push(compiler *const c, value v);
+static void parse_number(compiler *const c, int negate);
+static void parse_sum(compiler *const c);
+static void parse_product(compiler *const c);
+static void parse_unary(compiler *const c);
+static char peek(compiler *const c);
+
+/**
+	Constructs an empty arena.
+	@return The created arena
+	@memberof expr_arena
+*/
+expr_arena* arena_construct() {
+	expr_arena *a = (expr_arena *) malloc(sizeof(expr_arena));
+
+	if (!a) {
+		write_to_fd(2, "Failed to allocate expression arena\n");
+		exit(1);
+	}
+	a->head = NULL;
+	return a;
+}
+
+/**
+	Destructs the arena and all the bytecode stored in it.
+	@param a The arena
+	@memberof expr_arena
+*/
+void arena_destruct(expr_arena *a) {
+	arena_chunk *chunk;
+
+	if (a) {
+		while (a->head) {
+			chunk = a->head;
+			a->head = chunk->next;
+			free(chunk);
+		}
+		free(a);
+	}
+}
+
+/**
+	Compiles an expression into an operation. Parsing stops at the 
+	first character which cannot continue the expression.
+	@param src The expression
+	@param type The type of the expression
+	@param a The arena where bytecode is stored
+	@param dest Where to store the compiled operation
+	@return A pointer to the first character after the expression,
+	@c NULL if the expression is not valid
+	@memberof expr_arena
+*/
+char* expr_compile(char *src, value_type type, expr_arena *const a, operation *const dest) {
+	compiler c;
+	arena_chunk *chunk;
+	int i;
+
+	c.pos = src;
+	c.type = type;
+	c.length = c.depth = c.error = 0;
+	parse_sum(&c);
+	emit(&c, EXPR_END);
+	if (c.error)
+		return NULL;
+
+	if (c.length == 6 && c.code[0] == EXPR_PUSH && c.code[2] == EXPR_PUSH && c.code[4] >= EXPR_ADD && c.code[4] <= EXPR_DIV) {
+		dest->num1.i = c.code[1];
+		dest->op = "+-*/"[c.code[4] - EXPR_ADD];
+		dest->num2.i = c.code[3];
+		dest->type = type;
+		dest->code = NULL;
+		return c.pos;
+	}
+
+	chunk = a->head;
+	if (!chunk || chunk->capacity - chunk->used < c.length) {
+		chunk = (arena_chunk *) malloc(sizeof(arena_chunk) + ARENA_CHUNK * sizeof(int64_t));
+		if (!chunk) {
+			write_to_fd(2, "Failed to allocate expression arena\n");
+			exit(1);
+		}
+		chunk->next = a->head;
+		chunk->used = 0;
+		chunk->capacity = ARENA_CHUNK;
+		a->head = chunk;
+	}
+	for (i = 0; i < c.length; ++i)
+		chunk->code[chunk->used + i] = c.code[i];
+	dest->num1.i = 0;
+	dest->op = EXPR_OP;
+	dest->num2.i = 0;
+	dest->type = type;
+	dest->code = &chunk->code[chunk->used];
+	chunk->used += c.length;
+	return c.pos;
+}
+
+/**
+	Emits an instruction without operands, tracking the stack depth.
+	@param c The compiler
+	@param opcode The opcode
+*/
+static void emit(compiler *const c, int opcode) {
+	if (c->length == EXPR_MAX_CODE) {
+		c->error = 1;
+		return;
+	}
+	c->code[c->length++] = opcode;
+	if (opcode >= EXPR_ADD && opcode <= EXPR_DIV)
+		--c->depth;
+}
+
+/**
+	Emits an @c EXPR_PUSH instruction, tracking the stack depth.
+	The immediate operand holds the bits of the value.
+	@param c The compiler
+	@param v The value to push
+*/
+static void emit_push(compiler *const c, value v) {
+	if (c->length > EXPR_MAX_CODE - 2 || ++c->depth > EXPR_MAX_DEPTH) {
+		c->error = 1;
+		return;
+	}
+	c->code[c->length++] = EXPR_PUSH;
+	c->code[c->length++] = v.i;
+}
+
+/**
+	Parses a sequence of products separated by <tt>+</tt> or <tt>-</tt>.
+	@param c The compiler
+*/
+static void parse_sum(compiler *const c) {
+	char op;
+
+	parse_product(c);
+	while (!c->error && ((op = peek(c)) == '+' || op == '-')) {
+		++c->pos;
+		parse_product(c);
+		emit(c, op == '+' ? EXPR_ADD : EXPR_SUB);
+	}
+}
+
+/**
+	Parses a sequence of factors separated by <tt>*</tt> or <tt>/</tt>.
+	@param c The compiler
+*/
+static void parse_product(compiler *const c) {
+	char op;
+
+	parse_unary(c);
+	while (!c->error && ((op = peek(c)) == '*' || op == '/')) {
+		++c->pos;
+		parse_unary(c);
+		emit(c, op == '*' ? EXPR_MUL : EXPR_DIV);
+	}
+}
+
+/**
+	Parses a number, a parenthesized expression or a factor with
+	a unary sign. The negation of a number is folded into it.
+	@param c The compiler
+*/
+static void parse_unary(compiler *const c) {
+	switch (peek(c)) {
+		case '-': 
+			++c->pos;
+			if (isdigit((unsigned char) *c->pos) || *c->pos == '.')
+				parse_number(c, 1);
+			else {
+				parse_unary(c);
+				emit(c, EXPR_NEG);
+			}
+			break;
+		case '+':
+			++c->pos;
+			parse_unary(c);
+			break;
+		case '(': 
+			++c->pos;
+			parse_sum(c);
+			if (peek(c) != ')')
+				c->error = 1;
+			else
+				++c->pos;
+			break;
+		default:
+			parse_number(c, 0);
+	}
+}
+
+/**
+	Parses a number of the expression type and pushes it. 32 bit 
+	integers wrap around, as they would when computed.
+	@param c The compiler
+	@param negate Whether to push the opposite of the number
+*/
+static void parse_number(compiler *const c, int negate) {
+	char *end;
+	value v;
+
+	if (!isdigit((unsigned char) *c->pos) && (c->type != TYPE_F64 || *c->pos != '.')) {
+		c->error = 1;
+		return;
+	}
+	if (c->type == TYPE_F64) {
+		v.f = strtod(c->pos, &end);
+		if (negate)
+			v.f = -v.f;
+	} else {
+		v.i = (int64_t) strtoull(c->pos, &end, 10);
+		if (negate)
+			v.i = (int64_t) (0 - (uint64_t) v.i);
+		if (c->type == TYPE_I32)
+			v.i = (int32_t) v.i;
+		if (*end == '.')
+			c->error = 1;
+	}
+	c->pos = end;
+	emit_push(c, v);
+}
+
+/**
+	Skips the blanks and returns the next character, without consuming it.
+	@param c The compiler
+	@return The next character
+*/
+static char peek(compiler *const c) {
+	while (*c->pos == ' ' || *c->pos == '\t')
+		++c->pos;
+	return *c->pos;
+}
@@ -0,0 +1,53 @@
+/** @file
+	Public interface for the expression compiler.<br>
+	Expressions are compiled into a stack based bytecode for the 
+	type of the operation: each instruction is an opcode, followed 
+	by an immediate operand of that type for @c EXPR_PUSH, and the 
+	code ends with @c EXPR_END.
+	@see expr_arena
+*/
+
+#ifndef EXPR_H
+#define EXPR_H
+
+#include "project_types.h"
+
+/// The operator of operations which carry a compiled expression
+#define EXPR_OP 'E'
+
+/// The maximum number of values on the evaluation stack
+#define EXPR_MAX_DEPTH 64
+
+/// The maximum number of instructions of a single expression
+#define EXPR_MAX_CODE 512
+
+/// The number of instructions allocated at once by an arena
+#define ARENA_CHUNK 4096
+
+/// The bytecode opcodes
+enum expr_opcode {
+	/// Ends the expression: its value is on top of the stack
+	EXPR_END,
+	/// Pushes the immediate operand which follows
+	EXPR_PUSH,
+	/// Replaces the two values on top of the stack with their sum
+	EXPR_ADD,
+	/// Replaces the two values on top of the stack with their difference
+	EXPR_SUB,
+	/// Replaces the two values on top of the stack with their product
+	EXPR_MUL,
+	/// Replaces the two values on top of the stack with their quotient
+	EXPR_DIV,
+	/// Negates the value on top of the stack
+	EXPR_NEG
+};
+
+/// Stores the bytecode of all the compiled expressions.
+struct expr_arena;
+typedef struct expr_arena expr_arena;
+
+expr_arena* arena_construct();
+void arena_destruct(expr_arena *a);
+char* expr_compile(char *src, value_type type, expr_arena *const a, operation *const dest);
+
+#endif
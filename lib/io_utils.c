@@ -1,9 +1,12 @@
 /** @file
 	The input/output utilities used during execution:<ul>
-	<li>Conversion of an integer into a string
+	<li>Conversion of an integer into a string, and formatting of
+	values of each type
 	<li>Buffered read from a file descriptor
 	<li>Write on a file descriptor, with possibility to 
-	print all the results computed, or an integer value</ul>	
+	print all the results computed, or an integer value
+	<li>Creation of a memory-mapped binary results file
+	<li>Reading of a results file, in either format</ul>	
 */
 
 #include <fcntl.h>
@@ -11,6 +14,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include "io_utils.h"
@@ -18,8 +23,27 @@
 /// Constant buffer size
 #define BUF_SIZE 512
 
+/// The size of the buffer used to write the results file
+#define OUT_BUF_SIZE 65536
+
+/// The maximum length of a formatted value
+#define VALUE_LENGTH 32
+
+/// Formats a value into a buffer, returning its length
+typedef int (*formatter)(value v, char *const buffer);
+
+static int format_i32(value v, char *const buffer);
+static int format_i64(value v, char *const buffer);
+static int format_f64(value v, char *const buffer);
+static int format_unsigned(uint64_t num, int negative, char *const buffer);
+static size_t results_size(const results_header *const header);
 static int itoa(int num, char *const buffer, int buf_len);
 static char read_char(int fd);
+static void read_fully(int fd, void *dest, size_t size);
+static void write_fully(int fd, const char *buffer, size_t size);
+
+/// The formatter of each type
+static const formatter formatters[N_TYPES] = { format_i32, format_i64, format_f64 };
 
 /**
 	Reads a line from the specified file descriptor and
@@ -50,24 +74,249 @@ int read_line(int fd, char *const dest, const int max_length) {
 }
 
 /**
-	Writes the results array on the specified output file.<br> 
+	Creates a binary results file of the given length and maps it 
+	in memory, so that results can be stored directly into it.<br>
+	The file is preallocated and its header is filled in; results
+	are zeroed, their type, if present, is @c TYPE_I32 and their 
+	status, if present, is @c RESULT_PENDING.
+	@param pathname The output file's path
+	@param length The number of results
+	@param wide Whether results are stored as @ref value slots with
+	type bytes (version 2), rather than as 32 bit integers (version 1)
+	@param with_status Whether to reserve a status byte for each result
+	@return The mapped results array: @ref value slots if @c wide, 
+	@c int32_t slots otherwise
+	@see results_header
+*/
+void* map_results(const char *const pathname, int length, int wide, int with_status) {
+	results_header header;
+	size_t size;
+	void *base;
+	int fd;
+
+	header.magic = RESULTS_MAGIC;
+	header.version = wide ? RESULTS_VERSION : RESULTS_VERSION_I32;
+	header.elem_size = wide ? sizeof(value) : sizeof(int32_t);
+	header.flags = with_status ? RESULTS_HAS_STATUS : 0;
+	header.count = length;
+	header.reserved = 0;
+	size = results_size(&header);
+
+	fd = open(pathname, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		write_to_fd(2, "Failed to open results file\n");
+		exit(1);
+	}
+	if (ftruncate(fd, size) == -1) {
+		write_to_fd(2, "Failed to preallocate results file\n");
+		exit(1);
+	}
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		write_to_fd(2, "Failed to map results file\n");
+		exit(1);
+	}
+	if (close(fd) == -1) {
+		write_to_fd(2, "Failed to close results file\n");
+		exit(1);
+	}
+
+	*(results_header *) base = header;
+	return (results_header *) base + 1;
+}
+
+/**
+	Returns the type bytes of a mapped results array.
+	@param results The array returned by map_results()
+	@param length The results array length
+	@return The type bytes, @c NULL if the file has none
+*/
+unsigned char* results_types(void *results, int length) {
+	results_header *header = ((results_header *) results) - 1;
+
+	if (header->elem_size != sizeof(value))
+		return NULL;
+	return (unsigned char *) results + length * sizeof(value);
+}
+
+/**
+	Returns the status bytes of a mapped results array.
+	@param results The array returned by map_results()
+	@param length The results array length
+	@return The status bytes, @c NULL if the file has none
+*/
+unsigned char* results_status(void *results, int length) {
+	results_header *header = ((results_header *) results) - 1;
+
+	if (!(header->flags & RESULTS_HAS_STATUS))
+		return NULL;
+	return (unsigned char *) results + results_size(header) - sizeof(results_header) - length;
+}
+
+/**
+	Unmaps a results array created by map_results(). The results
+	reach the file through the page cache, without any formatting.
+	@param results The mapped results array
+*/
+void unmap_results(void *results) {
+	results_header *header = ((results_header *) results) - 1;
+
+	if (munmap(header, results_size(header)) == -1) {
+		write_to_fd(2, "Failed to unmap results file\n");
+		exit(1);
+	}
+}
+
+/**
+	Stores a result in an array of @ref value slots.
+	@param results The results array
+	@param index The index of the result
+	@param v The result
+*/
+void store_value(void *results, int index, value v) {
+	((value *) results)[index] = v;
+}
+
+/**
+	Stores a 32 bit integer result in an array of @c int32_t slots,
+	as the ones of version 1 binary results files.
+	@param results The results array
+	@param index The index of the result
+	@param v The result
+*/
+void store_int32(void *results, int index, value v) {
+	((int32_t *) results)[index] = (int32_t) v.i;
+}
+
+/**
+	Reads a results file written by a previous execution, either
+	in text or in binary format.
+	@param pathname The results file's path
+	@param length The expected number of results
+	@param types The type of each result, used to parse text files
+	@param status Where to store the status bytes, or @c NULL 
+	if the file has none. They must be freed by the caller
+	@return The results array, which must be freed by the caller
+*/
+value* read_results(const char *const pathname, int length, const unsigned char *const types, unsigned char **status) {
+	results_header header;
+	char line[BUF_SIZE];
+	int fd, len, i = 0;
+	int32_t *narrow;
+	value *results;
+
+	*status = NULL;
+	results = (value *) malloc(length * sizeof(value));
+	if (!results) {
+		write_to_fd(2, "Failed to allocate previous results\n");
+		exit(1);
+	}
+	fd = open(pathname, O_RDONLY);
+	if (fd == -1) {
+		write_to_fd(2, "Failed to open previous results file\n");
+		exit(1);
+	}
+	if (read(fd, &header, sizeof(results_header)) == sizeof(results_header) && header.magic == RESULTS_MAGIC) {
+		if (!((header.version == RESULTS_VERSION_I32 && header.elem_size == sizeof(int32_t)) || 
+			(header.version == RESULTS_VERSION && header.elem_size == sizeof(value)))) {
+			write_to_fd(2, "Unsupported results file format\n");
+			exit(1);
+		}
+		if (header.count != (uint32_t) length) {
+			write_to_fd(2, "Previous results do not match the previous setup file\n");
+			exit(1);
+		}
+		if (header.version == RESULTS_VERSION_I32) {
+			narrow = (int32_t *) malloc(length * sizeof(int32_t));
+			if (!narrow) {
+				write_to_fd(2, "Failed to allocate previous results\n");
+				exit(1);
+			}
+			read_fully(fd, narrow, length * sizeof(int32_t));
+			for (i = 0; i < length; ++i)
+				results[i].i = narrow[i];
+			free(narrow);
+		} else {
+			read_fully(fd, results, length * sizeof(value));
+			if (lseek(fd, length * sizeof(unsigned char), SEEK_CUR) == -1) {
+				write_to_fd(2, "Failed to read from file\n");
+				exit(1);
+			}
+		}
+		if (header.flags & RESULTS_HAS_STATUS) {
+			*status = (unsigned char *) malloc(length * sizeof(unsigned char));
+			if (!*status) {
+				write_to_fd(2, "Failed to allocate previous results\n");
+				exit(1);
+			}
+			read_fully(fd, *status, length * sizeof(unsigned char));
+		}
+	} else {
+		if (lseek(fd, 0, SEEK_SET) == -1) {
+			write_to_fd(2, "Failed to read from file\n");
+			exit(1);
+		}
+		do {
+			len = read_line(fd, line, BUF_SIZE);
+			if (len > 0) {
+				if (i == length) {
+					write_to_fd(2, "Previous results do not match the previous setup file\n");
+					exit(1);
+				}
+				if (types[i] == TYPE_F64)
+					results[i].f = strtod(line, NULL);
+				else
+					results[i].i = strtoll(line, NULL, 10);
+				++i;
+			}
+		} while (len >= 0);
+		if (i != length) {
+			write_to_fd(2, "Previous results do not match the previous setup file\n");
+			exit(1);
+		}
+	}
+
+	if (close(fd) == -1) {
+		write_to_fd(2, "Failed to close previous results file\n");
+		exit(1);
+	}
+	return results;
+}
+
+/**
+	Writes the results array on the specified output file, one 
+	result per line, formatted according to its type.<br> 
 	If the file does not exist, it's created.
 	@param pathname The output file's path
 	@param results The results array
+	@param types The type of each result
 	@param length The results array length
 */
-void write_results(const char *const pathname, int *results, int length) {
-	int fd, i;
+void write_results(const char *const pathname, value *results, const unsigned char *const types, int length) {
+	char *buffer;
+	int fd, i, used = 0;
 	
 	fd = open(pathname, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
 	if(fd == -1) {
 		write_to_fd(2, "Failed to open results file\n");
 		exit(1);
 	}
+	buffer = (char *) malloc(OUT_BUF_SIZE * sizeof(char));
+	if (!buffer) {
+		write_to_fd(2, "Failed to allocate output buffer\n");
+		exit(1);
+	}
 
 	for(i = 0; i < length; ++i) {
-		write_with_int(fd, "", results[i]);
+		if (used > OUT_BUF_SIZE - VALUE_LENGTH - 1) {
+			write_fully(fd, buffer, used);
+			used = 0;
+		}
+		used += formatters[types[i]](results[i], buffer + used);
+		buffer[used++] = '\n';
 	}
+	write_fully(fd, buffer, used);
+	free(buffer);
 	
 	if(close(fd) == -1) {
 		write_to_fd(2, "Failed to close results file\n");
@@ -112,6 +361,86 @@ void write_with_int(int fd, const char *const s, int num) {
 	free(message);
 }
 
+/**
+	Writes on the specified file descriptor a string followed 
+	by a value, formatted according to its type.
+	@param fd The file descriptor
+	@param s The string to write
+	@param v The value to write
+	@param type The type of the value
+*/
+void write_with_value(int fd, const char *const s, value v, int type) {
+	char *message;
+	int s_len = strlen(s), len;
+
+	message = (char *) malloc((s_len + VALUE_LENGTH + 2) * sizeof(char));
+	if (message == NULL) {
+		write_to_fd(2, "Failed to allocate message string\n");
+		return;
+	}
+	strcpy(message, s);
+	len = s_len + formatters[type](v, message + s_len);
+	message[len] = '\n';
+	message[len + 1] = '\0';
+	write_to_fd(fd, message);
+	free(message);
+}
+
+/**
+	Formats a 32 bit integer value.
+	@param v The value
+	@param buffer Where to store the digits, which are not terminated
+	@return The number of characters written
+*/
+static int format_i32(value v, char *const buffer) {
+	int32_t num = (int32_t) v.i;
+
+	return format_unsigned(num < 0 ? 0u - (uint32_t) num : (uint32_t) num, num < 0, buffer);
+}
+
+/**
+	Formats a 64 bit integer value.
+	@param v The value
+	@param buffer Where to store the digits, which are not terminated
+	@return The number of characters written
+*/
+static int format_i64(value v, char *const buffer) {
+	return format_unsigned(v.i < 0 ? 0u - (uint64_t) v.i : (uint64_t) v.i, v.i < 0, buffer);
+}
+
+/**
+	Formats a floating point value, with enough digits to read it 
+	back exactly.
+	@param v The value
+	@param buffer Where to store the number, which is terminated
+	@return The number of characters written, without the terminator
+*/
+static int format_f64(value v, char *const buffer) {
+	return snprintf(buffer, VALUE_LENGTH, "%.17g", v.f);
+}
+
+/**
+	Formats the magnitude of an integer, with its sign.
+	@param num The magnitude
+	@param negative Whether to prepend a minus sign
+	@param buffer Where to store the digits, which are not terminated
+	@return The number of characters written
+*/
+static int format_unsigned(uint64_t num, int negative, char *const buffer) {
+	char digits[20];
+	int i = 0, len = 0;
+
+	do {
+		digits[i++] = num % 10 + '0';
+		num /= 10;
+	} while (num > 0);
+	if (negative)
+		buffer[len++] = '-';
+	while (i > 0)
+		buffer[len++] = digits[--i];
+	return len;
+}
+
 /**
 	Converts an integer value into a string, which is stored
 	into buffer.
@@ -122,20 +451,20 @@ void write_with_int(int fd, const char *const s, int num) {
 */
 static int itoa(int num, char *const buffer, int buf_len) {
 	int i = 0, j = 0;
+	unsigned int magnitude = num < 0 ? 0u - (unsigned int) num : (unsigned int) num;
 	char temp;
 	
 	if (num == 0)
 		buffer[i++] = '0';
 	if (num < 0) {
 		buffer[i++] = '-';
-		num *= -1;
 		j++;
 	}
-	while ((i < buf_len - 1) && (num > 0)) {
-		buffer[i++] = num % 10 + '0';
-		num /= 10;
+	while ((i < buf_len - 1) && (magnitude > 0)) {
+		buffer[i++] = magnitude % 10 + '0';
+		magnitude /= 10;
 	}
-	if (num > 0)
+	if (magnitude > 0)
 		return -1;
 	buffer[i--] = '\0';
 	while (j < i) {
@@ -172,3 +501,60 @@ static char read_char(int fd) {
 	--chars_left;
 	return buffer[i++];
 }
+
+/**
+	Reads exactly the given number of bytes from the specified 
+	file descriptor, wrapping the read system call.
+	@param fd The file descriptor
+	@param dest The buffer where to store the data
+	@param size The number of bytes to read
+*/
+static void read_fully(int fd, void *dest, size_t size) {
+	ssize_t len;
+
+	while (size > 0) {
+		len = read(fd, dest, size);
+		if (len <= 0) {
+			write_to_fd(2, "Failed to read from file\n");
+			exit(1);
+		}
+		dest = (char *) dest + len;
+		size -= len;
+	}
+}
+
+/**
+	Computes the size of a binary results file.
+	@param header The file header
+	@return The size in bytes, including the header
+*/
+static size_t results_size(const results_header *const header) {
+	size_t size = sizeof(results_header) + (size_t) header->count * header->elem_size;
+
+	if (header->version == RESULTS_VERSION)
+		size += header->count * sizeof(unsigned char);
+	if (header->flags & RESULTS_HAS_STATUS)
+		size += header->count * sizeof(unsigned char);
+	return size;
+}
+
+/**
+	Writes a buffer on the specified file descriptor, wrapping
+	the write system call until all the data is written.
+	@param fd The file descriptor
+	@param buffer The data to write
+	@param size The number of bytes to write
+*/
+static void write_fully(int fd, const char *buffer, size_t size) {
+	ssize_t len;
+
+	while (size > 0) {
+		len = write(fd, buffer, size);
+		if (len == -1) {
+			write_to_fd(2, "Write failed\n");
+			exit(1);
+		}
+		buffer += len;
+		size -= len;
+	}
+}
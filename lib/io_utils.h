@@ -1,9 +1,72 @@
 #ifndef IO_UTILS_H
 #define IO_UTILS_H
 
+#include <stdint.h>
+#include "project_types.h"
+
+/// Identifies a binary results file ("ETRS" in little endian)
+#define RESULTS_MAGIC 0x53525445
+
+/// The binary results file format version
+#define RESULTS_VERSION 2
+
+/// The format version of binary results files holding only 32 bit integers
+#define RESULTS_VERSION_I32 1
+
+/// Set in the header flags when a status byte follows each result
+#define RESULTS_HAS_STATUS 0x01
+
+/// Status byte of an operation not computed yet
+#define RESULT_PENDING 0
+
+/// Status byte of an operation computed successfully
+#define RESULT_OK 1
+
+/// Status byte of an operation whose integer result overflowed
+#define RESULT_OVERFLOW 2
+
+/**
+	Header of a binary results file. It is followed by @c count
+	results of @c elem_size bytes each, by @c count type bytes 
+	(see @ref value_type) and, if the @c RESULTS_HAS_STATUS flag is
+	set, by @c count status bytes.<br>
+	In version 2 files each result is a @ref value: integers are 
+	stored as 64 bit values, floating point numbers as doubles. 
+	Jobs made only of 32 bit integer operations are written as 
+	version 1 files, which hold raw @c int32_t results and no type 
+	bytes.
+*/
+typedef struct results_header {
+	/// Always @c RESULTS_MAGIC
+	uint32_t magic;
+
+	/// The format version
+	uint16_t version;
+
+	/// The size in bytes of a single result
+	uint8_t elem_size;
+
+	/// Format flags
+	uint8_t flags;
+
+	/// The number of results
+	uint32_t count;
+
+	/// Reserved, always 0
+	uint32_t reserved;
+} results_header;
+
 int read_line(int fd, char *const dest, const int max_length);
-void write_results(const char *const pathname, int *results, int length);
+void* map_results(const char *const pathname, int length, int wide, int with_status);
+unsigned char* results_types(void *results, int length);
+unsigned char* results_status(void *results, int length);
+void unmap_results(void *results);
+void store_value(void *results, int index, value v);
+void store_int32(void *results, int index, value v);
+value* read_results(const char *const pathname, int length, const unsigned char *const types, unsigned char **status);
+void write_results(const char *const pathname, value *results, const unsigned char *const types, int length);
 void write_to_fd(int fd, const char *const s);
 void write_with_int(int fd, const char *const s, int num);
+void write_with_value(int fd, const char *const s, value v, int type);
 
 #endif
@@ -0,0 +1,230 @@
+/** @file
+	Contains the implementation of the memoization cache, which 
+	is used by the main thread to resolve repeated operations 
+	without dispatching them.<br>
+	The cache is set associative: each operation maps to a set of 
+	@c MEMO_WAYS entries, and sets are protected by @c MEMO_LOCKS 
+	mutexes, so that processors inserting results rarely contend. 
+	It lives in shared memory, with process-shared mutexes, so that
+	it is also shared by shards. The mutexes are robust: if a shard
+	terminates while holding one, the sets it protects are emptied,
+	since an entry may have been left half written, and the other 
+	shards go on.<br>
+	For details on functions, see @ref memo_cache.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "expr.h"
+#include "io_utils.h"
+#include "memo_cache.h"
+#include "op_index.h"
+#include "shard.h"
+#include "sync_utils.h"
+
+/// A cached operation and its result.
+typedef struct memo_entry {
+	/// The bits of the first operand
+	int64_t num1;
+
+	/// The bits of the second operand
+	int64_t num2;
+
+	/// The result
+	value result;
+
+	/// The operator, 0 if the entry is empty
+	char op;
+
+	/// The type of the operands and of the result
+	unsigned char type;
+} memo_entry;
+
+/// Tells whether an entry holds an operation, comparing the operand bits
+#define ENTRY_MATCHES(e, oper) ((e)->op == (oper)->op && (e)->type == (oper)->type && \
+	(e)->num1 == (oper)->num1.i && (e)->num2 == (oper)->num2.i)
+
+static void set_lock(memo_cache *const c, uint64_t set);
+
+///	Represents the cache, which is followed by its entries.
+struct memo_cache {
+	/// The size of the shared memory holding the cache
+	size_t size;
+
+	/// The number of sets, a power of two
+	uint64_t n_sets;
+
+	/// The number of lookups
+	uint64_t lookups;
+
+	/// The number of lookups which found the result
+	uint64_t hits;
+
+	/// The mutexes protecting the sets
+	pthread_mutex_t locks[MEMO_LOCKS];
+
+	/// The entries, @c MEMO_WAYS for each set
+	memo_entry entries[];
+};
+
+/**
+	Constructs an empty cache in shared memory.
+	@param budget The maximum memory used by the cache entries, in bytes
+	@return The created cache
+	@memberof memo_cache
+*/
+memo_cache* memo_construct(size_t budget) {
+	pthread_mutexattr_t attr;
+	uint64_t n_sets = 1;
+	memo_cache *c;
+	size_t size;
+	int i;
+
+	while (2 * n_sets * MEMO_WAYS * sizeof(memo_entry) <= budget)
+		n_sets *= 2;
+	size = sizeof(memo_cache) + n_sets * MEMO_WAYS * sizeof(memo_entry);
+	c = (memo_cache *) shared_alloc(size);
+	c->size = size;
+	c->n_sets = n_sets;
+	c->lookups = 0;
+	c->hits = 0;
+	if (pthread_mutexattr_init(&attr) != 0 ||
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 ||
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) != 0) {
+		write_to_fd(2, "Failed to initialize cache mutexes\n");
+		exit(1);
+	}
+	for (i = 0; i < MEMO_LOCKS; ++i) {
+		if (pthread_mutex_init(&c->locks[i], &attr) != 0) {
+			write_to_fd(2, "Failed to initialize cache mutexes\n");
+			exit(1);
+		}
+	}
+	pthread_mutexattr_destroy(&attr);
+	return c;
+}
+
+/**
+	Destructs the cache.
+	@param c The cache
+	@memberof memo_cache
+*/
+void memo_destruct(memo_cache *c) {
+	int i;
+
+	if (c) {
+		for (i = 0; i < MEMO_LOCKS; ++i)
+			mutex_destroy(&c->locks[i]);
+		shared_free(c, c->size);
+	}
+}
+
+/**
+	Looks up the result of an operation. Compiled expressions are
+	not cached.
+	@param c The cache
+	@param oper The operation
+	@param result Where to store the result, if found
+	@return 1 if the result was found, 0 otherwise
+	@memberof memo_cache
+*/
+int memo_lookup(memo_cache *const c, const operation *const oper, value *const result) {
+	uint64_t set;
+	memo_entry *e;
+	int i, found = 0;
+
+	if (oper->op == EXPR_OP)
+		return 0;
+	set = operation_hash(oper) & (c->n_sets - 1);
+	e = &c->entries[set * MEMO_WAYS];
+	set_lock(c, set);
+	for (i = 0; i < MEMO_WAYS && !found; ++i) {
+		if (ENTRY_MATCHES(&e[i], oper)) {
+			*result = e[i].result;
+			found = 1;
+		}
+	}
+	mutex_unlock(&c->locks[set % MEMO_LOCKS]);
+	__atomic_add_fetch(&c->lookups, 1, __ATOMIC_RELAXED);
+	if (found)
+		__atomic_add_fetch(&c->hits, 1, __ATOMIC_RELAXED);
+	return found;
+}
+
+/**
+	Stores the result of an operation, unless it is a compiled 
+	expression. If its set is full, an entry chosen by the 
+	operation hash is replaced.
+	@param c The cache
+	@param oper The operation
+	@param result The result
+	@memberof memo_cache
+*/
+void memo_insert(memo_cache *const c, const operation *const oper, value result) {
+	uint64_t hash, set;
+	memo_entry *e;
+	int i, way;
+
+	if (oper->op == EXPR_OP)
+		return;
+	hash = operation_hash(oper);
+	set = hash & (c->n_sets - 1);
+	e = &c->entries[set * MEMO_WAYS];
+	way = (hash >> 32) % MEMO_WAYS;
+	set_lock(c, set);
+	for (i = 0; i < MEMO_WAYS; ++i) {
+		if (e[i].op == 0 || ENTRY_MATCHES(&e[i], oper)) {
+			way = i;
+			break;
+		}
+	}
+	e[way].num1 = oper->num1.i;
+	e[way].num2 = oper->num2.i;
+	e[way].result = result;
+	e[way].op = oper->op;
+	e[way].type = oper->type;
+	mutex_unlock(&c->locks[set % MEMO_LOCKS]);
+}
+
+/**
+	Prints the number of lookups and the hit rate of the cache.
+	@param c The cache
+	@memberof memo_cache
+*/
+void memo_report(const memo_cache *const c) {
+	value v;
+
+	v.i = c->lookups;
+	write_with_value(1, "\nCache lookups: ", v, TYPE_I64);
+	v.i = c->hits;
+	write_with_value(1, "Cache hits: ", v, TYPE_I64);
+	v.i = c->lookups ? c->hits * 100 / c->lookups : 0;
+	write_with_value(1, "Cache hit rate (%): ", v, TYPE_I64);
+}
+
+/**
+	Locks the mutex of a set. If its previous owner terminated while
+	holding it, the sets it protects are emptied and the mutex is made
+	consistent again.
+	@param c The cache
+	@param set The set index
+*/
+static void set_lock(memo_cache *const c, uint64_t set) {
+	pthread_mutex_t *lock = &c->locks[set % MEMO_LOCKS];
+	int res = pthread_mutex_lock(lock);
+	uint64_t i;
+	int way;
+	
+	if (res == EOWNERDEAD) {
+		for (i = set % MEMO_LOCKS; i < c->n_sets; i += MEMO_LOCKS) {
+			for (way = 0; way < MEMO_WAYS; ++way)
+				c->entries[i * MEMO_WAYS + way].op = 0;
+		}
+		pthread_mutex_consistent(lock);
+	} else if (res != 0) {
+		write_to_fd(2, "Failed to lock cache mutex\n");
+		exit(1);
+	}
+}
@@ -0,0 +1,28 @@
+/** @file
+	Public interface for the memoization cache of computed operations.
+	@see memo_cache
+*/
+
+#ifndef MEMO_CACHE_H
+#define MEMO_CACHE_H
+
+#include <stddef.h>
+#include "project_types.h"
+
+/// The number of mutexes the cache sets are distributed over
+#define MEMO_LOCKS 64
+
+/// The number of entries in a cache set
+#define MEMO_WAYS 4
+
+/// A fixed size cache of operation results, shared by all processors.
+struct memo_cache;
+typedef struct memo_cache memo_cache;
+
+memo_cache* memo_construct(size_t budget);
+void memo_destruct(memo_cache *c);
+int memo_lookup(memo_cache *const c, const operation *const oper, value *const result);
+void memo_insert(memo_cache *const c, const operation *const oper, value result);
+void memo_report(const memo_cache *const c);
+
+#endif
@@ -0,0 +1,161 @@
+/** @file
+	Contains the implementation of the index of operation results,
+	which is used by the main thread to reuse the results of a 
+	previous execution.<br>
+	The index is a hash table with open addressing and linear 
+	probing, sized for the number of operations it will hold.<br>
+	For details on functions, see @ref op_index.
+*/
+
+#include <stdlib.h>
+#include "expr.h"
+#include "io_utils.h"
+#include "op_index.h"
+
+/// An indexed operation and its result.
+typedef struct index_entry {
+	/// The operation
+	operation oper;
+
+	/// The result
+	value result;
+
+	/// Nonzero if the entry is used
+	int used;
+} index_entry;
+
+///	Represents the index.
+struct op_index {
+	/// The entries
+	index_entry *entries;
+
+	/// The number of entries, a power of two
+	uint64_t size;
+};
+
+/**
+	Computes the hash of an operation, mixing its fields with the
+	SplitMix64 finalizer. The hash of a compiled expression 
+	depends on its bytecode.
+	@param oper The operation
+	@return The hash
+*/
+uint64_t operation_hash(const operation *const oper) {
+	const int64_t *code;
+	uint64_t h;
+
+	h = ((uint64_t) oper->num1.i * 0x9e3779b97f4a7c15ULL) ^ (uint64_t) oper->num2.i ^ 
+		((uint64_t) (unsigned char) oper->op << 56) ^ ((uint64_t) oper->type << 48);
+	if (oper->op == EXPR_OP) {
+		for (code = oper->code; *code != EXPR_END; ++code) {
+			if (*code == EXPR_PUSH)
+				h = (h ^ (uint64_t) *code++) * 0x100000001b3ULL;
+			h = (h ^ (uint64_t) *code) * 0x100000001b3ULL;
+		}
+	}
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+/**
+	Checks whether two operations are the same: same type, and same
+	operator and operands or same bytecode. Operands are compared 
+	bitwise.
+	@param a The first operation
+	@param b The second operation
+	@return 1 if the operations are the same, 0 otherwise
+*/
+int operation_equal(const operation *const a, const operation *const b) {
+	const int64_t *x, *y;
+
+	if (a->op != b->op || a->type != b->type)
+		return 0;
+	if (a->op != EXPR_OP)
+		return a->num1.i == b->num1.i && a->num2.i == b->num2.i;
+	for (x = a->code, y = b->code; *x == *y; ++x, ++y) {
+		if (*x == EXPR_END)
+			return 1;
+		if (*x == EXPR_PUSH && *++x != *++y)
+			return 0;
+	}
+	return 0;
+}
+
+/**
+	Constructs an empty index.
+	@param n_ops The maximum number of operations to insert
+	@return The created index
+	@memberof op_index
+*/
+op_index* index_construct(int n_ops) {
+	op_index *idx = (op_index *) malloc(sizeof(op_index));
+
+	if (idx) {
+		for (idx->size = 1; idx->size < 2 * (uint64_t) n_ops; idx->size *= 2);
+		idx->entries = (index_entry *) calloc(idx->size, sizeof(index_entry));
+	}
+	if (!idx || !idx->entries) {
+		write_to_fd(2, "Failed to allocate results index\n");
+		exit(1);
+	}
+	return idx;
+}
+
+/**
+	Destructs the index.
+	@param idx The index
+	@memberof op_index
+*/
+void index_destruct(op_index *idx) {
+	if (idx) {
+		free(idx->entries);
+		free(idx);
+	}
+}
+
+/**
+	Stores the result of an operation, replacing the previous one.
+	@param idx The index
+	@param oper The operation
+	@param result The result
+	@memberof op_index
+*/
+void index_insert(op_index *const idx, const operation *const oper, value result) {
+	uint64_t i = operation_hash(oper) & (idx->size - 1);
+	index_entry *e;
+
+	for (e = &idx->entries[i]; e->used; e = &idx->entries[i]) {
+		if (operation_equal(&e->oper, oper))
+			break;
+		i = (i + 1) & (idx->size - 1);
+	}
+	e->oper = *oper;
+	e->result = result;
+	e->used = 1;
+}
+
+/**
+	Looks up the result of an operation.
+	@param idx The index
+	@param oper The operation
+	@param result Where to store the result, if found
+	@return 1 if the result was found, 0 otherwise
+	@memberof op_index
+*/
+int index_lookup(const op_index *const idx, const operation *const oper, value *const result) {
+	uint64_t i = operation_hash(oper) & (idx->size - 1);
+	const index_entry *e;
+
+	for (e = &idx->entries[i]; e->used; e = &idx->entries[i]) {
+		if (operation_equal(&e->oper, oper)) {
+			*result = e->result;
+			return 1;
+		}
+		i = (i + 1) & (idx->size - 1);
+	}
+	return 0;
+}
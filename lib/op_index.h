@@ -0,0 +1,23 @@
+/** @file
+	Public interface for the index of operation results.
+	@see op_index
+*/
+
+#ifndef OP_INDEX_H
+#define OP_INDEX_H
+
+#include <stdint.h>
+#include "project_types.h"
+
+/// An exact map from operations to their results.
+struct op_index;
+typedef struct op_index op_index;
+
+uint64_t operation_hash(const operation *const oper);
+int operation_equal(const operation *const a, const operation *const b);
+op_index* index_construct(int n_ops);
+void index_destruct(op_index *idx);
+void index_insert(op_index *const idx, const operation *const oper, value result);
+int index_lookup(const op_index *const idx, const operation *const oper, value *const result);
+
+#endif
@@ -6,19 +6,71 @@
 #define PROJECT_TYPES_H
 
 #include <pthread.h>
+#include <stdint.h>
+#include "trace.h"
+
+struct memo_cache;
+
+/// The types operations can compute on
+typedef enum value_type {
+	/// 32 bit signed integer, the default
+	TYPE_I32,
+	/// 64 bit signed integer
+	TYPE_I64,
+	/// Double precision floating point
+	TYPE_F64,
+	/// The number of types
+	N_TYPES
+} value_type;
+
+/// An operand or result of any type
+typedef union value {
+	/// The value of the integer types. 32 bit values are sign extended
+	int64_t i;
+
+	/// The value of the floating point type
+	double f;
+} value;
+
+/// Stores a result at the given index of a results array
+typedef void (*result_store)(void *results, int index, value v);
 
 /// Used by the main process to send operations to processors
 typedef struct operation {
 	/// The first operand, also used to store the result
-	int num1;
-	
-	/// The operator, also used to pass the termination command
-	char op;
+	value num1;
 	
 	/// The second operand
-	int num2;
+	value num2;
+
+	/// The operator, also used to pass the termination command.
+	/// @c EXPR_OP if the operation is a compiled expression
+	char op;
+
+	/// The type of the operands and of the result
+	unsigned char type;
+
+	/// The bytecode of a compiled expression, @c NULL for a 
+	/// single binary operation
+	const int64_t *code;
 } operation;
 
+/// An operation read from the setup file
+typedef struct task {
+	/// The operation to compute
+	operation oper;
+
+	/// The processor ID the operation is pinned to, or @c ANY_PROCESSOR
+	int processor;
+
+	/// The priority class of the operation
+	int priority;
+
+	/// Nonzero if the result is already known, so the operation 
+	/// must not be dispatched
+	int done;
+} task;
+
 /// Used to pass arguments to processor threads
 typedef struct thread_args {
 	/// The identification number of the processor
@@ -36,6 +88,24 @@ typedef struct thread_args {
 	/// The pointer to the processor state
 	int *state;
 
+	/// The results array, indexed by operation number
+	void *results;
+
+	/// Stores a result in the results array, according to its layout
+	result_store store;
+
+	/// The status bytes of the results, @c NULL if not kept
+	unsigned char *status;
+
+	/// The completion time of each operation, in nanoseconds
+	uint64_t *finish;
+
+	/// The cache where results are stored, @c NULL if disabled
+	struct memo_cache *cache;
+
+	/// Nonzero if integer overflows must be detected
+	int overflow_check;
+
 	/// The pointer to the free threads counter
 	int *free_count;
 
@@ -50,6 +120,9 @@ typedef struct thread_args {
 	
 	/// Used by the processor to signal when the computation is done
 	pthread_cond_t *ready_cond;
+
+	/// The processor's trace buffer, @c NULL if tracing is disabled
+	trace_buffer *trace;
 } thread_args;
 
 #endif
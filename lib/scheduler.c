@@ -0,0 +1,319 @@
+/** @file
+	Contains the implementation of the priority scheduler, which is
+	used by the main thread to choose the next operation to dispatch.
+	<br>For details on functions, see @ref scheduler.
+*/
+
+#include <stdlib.h>
+#include <time.h>
+#include "io_utils.h"
+#include "scheduler.h"
+
+/**
+	Represents the operations waiting to be dispatched.<br>
+	Each priority class has a FIFO queue for every processor, 
+	holding the operations pinned to it, plus a queue for the 
+	operations which can run anywhere. Queues are linked lists 
+	of operation indexes, stored in the @c next array.<br>
+	With soft pinning, the processor an operation is pinned to is
+	only a preference: a free processor with nothing else to do 
+	takes the operations queued for the busy processor with the 
+	most pending work.
+*/
+struct scheduler {
+	/// The number of processors
+	int n_processors;
+
+	/// Nonzero if pinned operations can migrate to other processors
+	int soft_pinning;
+
+	/// The number of operations waiting for each processor
+	int *depths;
+
+	/// The number of operations migrated to another processor
+	int migrations;
+
+	/// The first operation of each queue, -1 if empty
+	int *heads;
+
+	/// The last operation of each queue
+	int *tails;
+
+	/// The operation following each one in its queue, -1 if last
+	int *next;
+
+	/// The number of waiting operations in each priority class
+	int pending[PRIORITY_CLASSES];
+
+	/// The total number of waiting operations
+	int count;
+};
+
+static int compare_latencies(const void *a, const void *b);
+static int queue_pop(scheduler *const s, int queue);
+
+/**
+	Constructs an empty scheduler.
+	@param n_ops The total number of operations
+	@param n_processors The number of processors
+	@param soft_pinning Whether pinned operations can migrate
+	@return The created scheduler
+	@memberof scheduler
+*/
+scheduler* scheduler_construct(int n_ops, int n_processors, int soft_pinning) {
+	scheduler *s;
+	int i, n_queues = PRIORITY_CLASSES * (n_processors + 1);
+
+	s = (scheduler *) malloc(sizeof(scheduler));
+	if (s) {
+		s->heads = (int *) malloc(n_queues * sizeof(int));
+		s->tails = (int *) malloc(n_queues * sizeof(int));
+		s->next = (int *) malloc(n_ops * sizeof(int));
+		s->depths = (int *) calloc(n_processors, sizeof(int));
+	}
+	if (!s || !s->heads || !s->tails || !s->next || !s->depths) {
+		write_to_fd(2, "Failed to allocate scheduler\n");
+		exit(1);
+	}
+	s->n_processors = n_processors;
+	s->soft_pinning = soft_pinning;
+	s->migrations = 0;
+	for (i = 0; i < n_queues; ++i)
+		s->heads[i] = -1;
+	for (i = 0; i < PRIORITY_CLASSES; ++i)
+		s->pending[i] = 0;
+	s->count = 0;
+	return s;
+}
+
+/**
+	Destructs the scheduler.
+	@param s The scheduler
+	@memberof scheduler
+*/
+void scheduler_destruct(scheduler *s) {
+	if (s) {
+		free(s->heads);
+		free(s->tails);
+		free(s->next);
+		free(s->depths);
+		free(s);
+	}
+}
+
+/**
+	Appends an operation to the queue of its priority class and 
+	processor.<br>Runs in constant time.
+	@param s The scheduler
+	@param op The operation index
+	@param processor The processor ID, or @c ANY_PROCESSOR
+	@param priority The priority class
+	@memberof scheduler
+*/
+void scheduler_push(scheduler *const s, int op, int processor, int priority) {
+	int queue = priority * (s->n_processors + 1) + processor + 1;
+
+	s->next[op] = -1;
+	if (s->heads[queue] == -1)
+		s->heads[queue] = op;
+	else
+		s->next[s->tails[queue]] = op;
+	s->tails[queue] = op;
+	if (processor != ANY_PROCESSOR)
+		++s->depths[processor];
+	++s->pending[priority];
+	++s->count;
+}
+
+/**
+	Extracts the operation to dispatch next: the oldest one of the
+	highest priority class which has an operation runnable on a 
+	free processor. The candidates are the heads of the queues of 
+	the free processors and of the queue of the operations which 
+	can run anywhere; since queues are FIFO, the oldest is the one 
+	with the lowest index. Operations migrated from a busy processor
+	are only taken when there are no candidates.<br>
+	Runs in time linear in the number of processors.
+	@param s The scheduler
+	@param states The array of processor states (free if <= 0)
+	@param processor Where to store the chosen processor
+	@return The operation index, -1 if no operation can be dispatched
+	@memberof scheduler
+*/
+int scheduler_next(scheduler *const s, const int *const states, int *const processor) {
+	int c, i, base, queue, any = -1, donor;
+
+	for (c = PRIORITY_CLASSES - 1; c >= 0; --c) {
+		if (s->pending[c] == 0)
+			continue;
+		base = c * (s->n_processors + 1) + 1;
+		queue = -1;
+		for (i = 0; i < s->n_processors; ++i) {
+			if (states[i] > 0)
+				continue;
+			if (s->heads[base + i] != -1 && (queue == -1 || s->heads[base + i] < s->heads[queue])) {
+				queue = base + i;
+				*processor = i;
+			}
+			if (any == -1)
+				any = i;
+		}
+		if (any == -1)
+			return -1;
+		if (s->heads[base - 1] != -1 && (queue == -1 || s->heads[base - 1] < s->heads[queue])) {
+			queue = base - 1;
+			*processor = any;
+		}
+		if (queue != -1)
+			return queue_pop(s, queue);
+		if (s->soft_pinning) {
+			donor = -1;
+			for (i = 0; i < s->n_processors; ++i) {
+				if (s->heads[base + i] != -1 && (donor == -1 || s->depths[i] > s->depths[donor]))
+					donor = i;
+			}
+			if (donor != -1) {
+				*processor = any;
+				++s->migrations;
+				return queue_pop(s, base + donor);
+			}
+		}
+	}
+	return -1;
+}
+
+/**
+	Returns the number of queues, which are numbered from 0.
+	@param s The scheduler
+	@return The number of queues
+	@memberof scheduler
+*/
+int scheduler_queues(const scheduler *const s) {
+	return PRIORITY_CLASSES * (s->n_processors + 1);
+}
+
+/**
+	Returns the first operation of a queue, without extracting it.
+	@param s The scheduler
+	@param queue The queue index
+	@return The operation index, -1 if the queue is empty
+	@memberof scheduler
+*/
+int scheduler_head(const scheduler *const s, int queue) {
+	return s->heads[queue];
+}
+
+/**
+	Extracts the first operation of a queue, regardless of the 
+	state of the processors: it is used for operations which are 
+	completed without being dispatched.
+	@param s The scheduler
+	@param queue The queue index, which must not be empty
+	@return The operation index
+	@memberof scheduler
+*/
+int scheduler_take(scheduler *const s, int queue) {
+	return queue_pop(s, queue);
+}
+
+/**
+	Returns the number of operations waiting to be dispatched.
+	@param s The scheduler
+	@return The number of operations
+	@memberof scheduler
+*/
+int scheduler_count(const scheduler *const s) {
+	return s->count;
+}
+
+/**
+	Returns the number of pinned operations dispatched to a 
+	processor other than their own.
+	@param s The scheduler
+	@return The number of migrated operations
+	@memberof scheduler
+*/
+int scheduler_migrations(const scheduler *const s) {
+	return s->migrations;
+}
+
+/**
+	Reads the monotonic clock used to measure latencies.
+	@return The current time, in nanoseconds
+*/
+uint64_t scheduler_clock() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+	Prints, for each priority class, the number of operations and
+	their latency from the start of the dispatch to their completion.
+	Operations which were not dispatched, or which were never 
+	computed because their shard terminated, are not considered.
+	@param tasks The operations
+	@param status The results status bytes, @c NULL if not kept
+	@param latencies The latency of each operation, in nanoseconds
+	@param n_ops The number of operations
+*/
+void scheduler_report(const task *const tasks, const unsigned char *const status, const uint64_t *const latencies, int n_ops) {
+	uint64_t *sorted, sum;
+	int c, i, n;
+
+	sorted = (uint64_t *) malloc(n_ops * sizeof(uint64_t));
+	if (!sorted) {
+		write_to_fd(2, "Failed to allocate latency report\n");
+		return;
+	}
+	for (c = PRIORITY_CLASSES - 1; c >= 0; --c) {
+		sum = 0;
+		for (i = n = 0; i < n_ops; ++i) {
+			if (tasks[i].priority == c && !tasks[i].done && (!status || status[i] != RESULT_PENDING)) {
+				sorted[n++] = latencies[i];
+				sum += latencies[i];
+			}
+		}
+		if (n == 0)
+			continue;
+		qsort(sorted, n, sizeof(uint64_t), compare_latencies);
+		write_with_int(1, "\nPriority class ", c);
+		write_with_int(1, "Operations: ", n);
+		write_with_int(1, "Mean latency (us): ", sum / n / 1000);
+		write_with_int(1, "Median latency (us): ", sorted[n / 2] / 1000);
+		write_with_int(1, "99th percentile latency (us): ", sorted[(n - 1) * 99 / 100] / 1000);
+		write_with_int(1, "Max latency (us): ", sorted[n - 1] / 1000);
+	}
+	free(sorted);
+}
+
+/**
+	Compares two latencies, for sorting.
+	@param a The first latency
+	@param b The second latency
+	@return A negative value, zero or a positive value if the first 
+	latency is less than, equal to or greater than the second
+*/
+static int compare_latencies(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+	Extracts the first operation of a queue, which must not be empty.
+	@param s The scheduler
+	@param queue The queue index
+	@return The operation index
+*/
+static int queue_pop(scheduler *const s, int queue) {
+	int op = s->heads[queue];
+
+	s->heads[queue] = s->next[op];
+	if (queue % (s->n_processors + 1) != 0)
+		--s->depths[queue % (s->n_processors + 1) - 1];
+	--s->pending[queue / (s->n_processors + 1)];
+	--s->count;
+	return op;
+}
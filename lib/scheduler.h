@@ -0,0 +1,34 @@
+/** @file
+	Public interface for the priority scheduler.
+	@see scheduler
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include "project_types.h"
+
+/// The number of priority classes: 0 is the lowest, the default one
+#define PRIORITY_CLASSES 8
+
+/// The processor ID of operations which can run on any processor
+#define ANY_PROCESSOR -1
+
+/// A set of priority queues of operations, per processor.
+struct scheduler;
+typedef struct scheduler scheduler;
+
+scheduler* scheduler_construct(int n_ops, int n_processors, int soft_pinning);
+void scheduler_destruct(scheduler *s);
+void scheduler_push(scheduler *const s, int op, int processor, int priority);
+int scheduler_next(scheduler *const s, const int *const states, int *const processor);
+int scheduler_queues(const scheduler *const s);
+int scheduler_head(const scheduler *const s, int queue);
+int scheduler_take(scheduler *const s, int queue);
+int scheduler_count(const scheduler *const s);
+int scheduler_migrations(const scheduler *const s);
+uint64_t scheduler_clock();
+void scheduler_report(const task *const tasks, const unsigned char *const status, const uint64_t *const latencies, int n_ops);
+
+#endif
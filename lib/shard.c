@@ -0,0 +1,289 @@
+/** @file
+	Contains the shared memory utilities used to run processors in
+	separate worker processes (shards):<ul>
+	<li>Allocation of memory shared with the child processes, 
+	backed by an anonymous memory file
+	<li>The rings which carry operation indexes from the main 
+	process to the shards</ul>
+	Rings are synchronized with process-shared mutexes and condition
+	variables, which are futex based. The mutexes are robust, so 
+	that a shard terminating abnormally cannot block the main process.
+	<br>For details on rings, see @ref shard_ring.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "io_utils.h"
+#include "shard.h"
+#include "sync_utils.h"
+
+/// How long a producer waits on a full ring before checking the consumer, in ms
+#define PUSH_TIMEOUT_MS 100
+
+/**
+	Represents a ring in shared memory. The @c slots array
+	follows the structure.
+*/
+struct shard_ring {
+	/// The mutex protecting the ring
+	pthread_mutex_t mutex;
+
+	/// Signaled when an operation is pushed or the ring is closed
+	pthread_cond_t not_empty;
+
+	/// Signaled when an operation is popped
+	pthread_cond_t not_full;
+
+	/// The maximum number of operations
+	int capacity;
+
+	/// The index of the first operation
+	int head;
+
+	/// The number of operations in the ring
+	int count;
+
+	/// Nonzero when no more operations will be pushed
+	int closed;
+
+	/// The operation indexes
+	int slots[];
+};
+
+static int consumer_exited(pid_t consumer);
+static void ring_lock(shard_ring *const r);
+static int wait_not_full(shard_ring *const r, pid_t consumer);
+
+/**
+	Allocates zeroed memory which is shared with the processes 
+	forked afterwards.
+	@param size The size in bytes
+	@return The allocated memory
+*/
+void* shared_alloc(size_t size) {
+	void *mem;
+	int fd;
+
+	fd = memfd_create("elaborato", MFD_CLOEXEC);
+	if (fd == -1 || ftruncate(fd, size) == -1) {
+		write_to_fd(2, "Failed to create shared memory segment\n");
+		exit(1);
+	}
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		write_to_fd(2, "Failed to map shared memory segment\n");
+		exit(1);
+	}
+	if (close(fd) == -1) {
+		write_to_fd(2, "Failed to close shared memory segment\n");
+		exit(1);
+	}
+	return mem;
+}
+
+/**
+	Frees memory allocated with shared_alloc().
+	@param mem The shared memory
+	@param size The size in bytes
+*/
+void shared_free(void *mem, size_t size) {
+	if (mem && munmap(mem, size) == -1)
+		write_to_fd(2, "Failed to unmap shared memory segment\n");
+}
+
+/**
+	Constructs an empty ring in shared memory.
+	@param capacity The maximum number of operations
+	@return The created ring
+	@memberof shard_ring
+*/
+shard_ring* ring_construct(int capacity) {
+	pthread_mutexattr_t mutex_attr;
+	pthread_condattr_t cond_attr;
+	shard_ring *r;
+
+	r = (shard_ring *) shared_alloc(sizeof(shard_ring) + capacity * sizeof(int));
+	if (pthread_mutexattr_init(&mutex_attr) != 0 ||
+		pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED) != 0 ||
+		pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST) != 0 ||
+		pthread_mutex_init(&r->mutex, &mutex_attr) != 0) {
+		write_to_fd(2, "Failed to initialize ring mutex\n");
+		exit(1);
+	}
+	if (pthread_condattr_init(&cond_attr) != 0 ||
+		pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED) != 0 ||
+		pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC) != 0 ||
+		pthread_cond_init(&r->not_empty, &cond_attr) != 0 ||
+		pthread_cond_init(&r->not_full, &cond_attr) != 0) {
+		write_to_fd(2, "Failed to initialize ring condition variables\n");
+		exit(1);
+	}
+	pthread_mutexattr_destroy(&mutex_attr);
+	pthread_condattr_destroy(&cond_attr);
+	r->capacity = capacity;
+	r->head = 0;
+	r->count = 0;
+	r->closed = 0;
+	return r;
+}
+
+/**
+	Destructs the ring. No process may be using it.<br>
+	The mutex and condition variables are not destroyed: a consumer
+	which terminated while waiting stays registered as a waiter, and
+	destroying the condition variable would wait for it forever. 
+	Unmapping the ring releases them anyway.
+	@param r The ring
+	@memberof shard_ring
+*/
+void ring_destruct(shard_ring *r) {
+	if (r) {
+		shared_free(r, sizeof(shard_ring) + r->capacity * sizeof(int));
+	}
+}
+
+/**
+	Appends an operation to the ring, waiting while it is full.
+	The consumer process is checked before pushing, and periodically
+	while waiting.
+	@param r The ring
+	@param op The operation index
+	@param consumer The process which pops from the ring
+	@return 0 on success, -1 if the consumer has exited
+	@memberof shard_ring
+*/
+int ring_push(shard_ring *const r, int op, pid_t consumer) {
+	if (consumer_exited(consumer))
+		return -1;
+	ring_lock(r);
+	if (wait_not_full(r, consumer) == -1) {
+		mutex_unlock(&r->mutex);
+		return -1;
+	}
+	r->slots[(r->head + r->count) % r->capacity] = op;
+	++r->count;
+	cond_signal(&r->not_empty);
+	mutex_unlock(&r->mutex);
+	return 0;
+}
+
+/**
+	Returns the number of operations which can be pushed without 
+	waiting. Since only one process pushes, the room can only grow 
+	until it pushes again.
+	@param r The ring
+	@param consumer The process which pops from the ring
+	@param block Whether to wait while the ring is full. While 
+	waiting, the consumer process is periodically checked
+	@return The number of free slots, -1 if the consumer has exited
+	@memberof shard_ring
+*/
+int ring_room(shard_ring *const r, pid_t consumer, int block) {
+	int room;
+
+	ring_lock(r);
+	if (block && wait_not_full(r, consumer) == -1)
+		room = -1;
+	else
+		room = r->capacity - r->count;
+	mutex_unlock(&r->mutex);
+	return room;
+}
+
+/**
+	Extracts an operation from the ring.
+	@param r The ring
+	@param block Whether to wait while the ring is empty and open
+	@return The operation index, -1 if the ring is empty
+	@memberof shard_ring
+*/
+int ring_pop(shard_ring *const r, int block) {
+	int op = -1;
+
+	ring_lock(r);
+	while (block && r->count == 0 && !r->closed)
+		cond_wait(&r->not_empty, &r->mutex);
+	if (r->count > 0) {
+		op = r->slots[r->head];
+		r->head = (r->head + 1) % r->capacity;
+		--r->count;
+		cond_signal(&r->not_full);
+	}
+	mutex_unlock(&r->mutex);
+	return op;
+}
+
+/**
+	Closes the ring: consumers waiting on an empty ring are released.
+	@param r The ring
+	@memberof shard_ring
+*/
+void ring_close(shard_ring *const r) {
+	ring_lock(r);
+	r->closed = 1;
+	if (pthread_cond_broadcast(&r->not_empty) != 0)
+		write_to_fd(2, "Failed to broadcast condition\n");
+	mutex_unlock(&r->mutex);
+}
+
+/**
+	Checks, without reaping it, whether a child process has exited.
+	@param consumer The child process
+	@return 1 if the process has exited, 0 otherwise
+*/
+static int consumer_exited(pid_t consumer) {
+	siginfo_t info;
+
+	info.si_pid = 0;
+	if (waitid(P_PID, consumer, &info, WEXITED | WNOHANG | WNOWAIT) == -1)
+		return 1;
+	return info.si_pid != 0;
+}
+
+/**
+	Locks the ring mutex. If its previous owner terminated while
+	holding it, the mutex is made consistent again.
+	@param r The ring
+*/
+static void ring_lock(shard_ring *const r) {
+	int res = pthread_mutex_lock(&r->mutex);
+
+	if (res == EOWNERDEAD)
+		pthread_mutex_consistent(&r->mutex);
+	else if (res != 0) {
+		write_to_fd(2, "Failed to lock ring mutex\n");
+		exit(1);
+	}
+}
+
+/**
+	Waits while the ring is full, periodically checking the consumer
+	process. The ring mutex must be held.
+	@param r The ring
+	@param consumer The process which pops from the ring
+	@return 0 when the ring is not full, -1 if the consumer has exited
+*/
+static int wait_not_full(shard_ring *const r, pid_t consumer) {
+	struct timespec deadline;
+
+	while (r->count == r->capacity) {
+		if (consumer_exited(consumer))
+			return -1;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += PUSH_TIMEOUT_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec += 1;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		if (pthread_cond_timedwait(&r->not_full, &r->mutex, &deadline) == EOWNERDEAD)
+			pthread_mutex_consistent(&r->mutex);
+	}
+	return 0;
+}
@@ -0,0 +1,29 @@
+/** @file
+	Public interface for the shared memory utilities used to run
+	processors in separate worker processes (shards).
+	@see shard_ring
+*/
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/// The number of operations a ring can hold
+#define RING_CAPACITY 1024
+
+/// A bounded FIFO queue of operation indexes, shared between processes.
+struct shard_ring;
+typedef struct shard_ring shard_ring;
+
+void* shared_alloc(size_t size);
+void shared_free(void *mem, size_t size);
+shard_ring* ring_construct(int capacity);
+void ring_destruct(shard_ring *r);
+int ring_push(shard_ring *const r, int op, pid_t consumer);
+int ring_room(shard_ring *const r, pid_t consumer, int block);
+int ring_pop(shard_ring *const r, int block);
+void ring_close(shard_ring *const r);
+
+#endif
@@ -0,0 +1,180 @@
+/** @file
+	Contains the implementation of the execution tracer.<br>
+	Each thread records its events in its own preallocated
+	buffer, using the CPU timestamp counter, so that no 
+	synchronization is needed while recording.
+	At the end of the execution the buffers are written in the 
+	Chrome trace-event JSON format, which can be loaded by 
+	<tt>chrome://tracing</tt> and by the Perfetto UI.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "io_utils.h"
+#include "trace.h"
+
+/// Size of the buffer used to format a single event
+#define EVENT_BUF_SIZE 128
+
+static uint64_t read_ticks();
+static uint64_t read_ns();
+
+/// Timestamp counter value when the tracer was created
+static uint64_t start_ticks;
+
+/// Monotonic clock value, in nanoseconds, when the tracer was created
+static uint64_t start_ns;
+
+/**
+	Allocates the event buffers and starts the trace clock.<br>
+	Buffer 0 belongs to the main thread, buffer <i>i</i> to 
+	processor <i>i</i>.
+	@param n_buffers The number of buffers
+	@param capacity The number of events each buffer can hold
+	@return The buffers array
+*/
+trace_buffer* trace_construct(int n_buffers, int capacity) {
+	trace_buffer *buffers;
+	int i;
+
+	if (capacity > TRACE_MAX_EVENTS)
+		capacity = TRACE_MAX_EVENTS;
+	buffers = (trace_buffer *) malloc(n_buffers * sizeof(trace_buffer));
+	if (!buffers) {
+		write_to_fd(2, "Failed to allocate trace buffers\n");
+		exit(1);
+	}
+	for (i = 0; i < n_buffers; ++i) {
+		buffers[i].events = (trace_event *) malloc(capacity * sizeof(trace_event));
+		if (!buffers[i].events) {
+			write_to_fd(2, "Failed to allocate trace buffers\n");
+			exit(1);
+		}
+		buffers[i].count = 0;
+		buffers[i].capacity = capacity;
+		buffers[i].dropped = 0;
+		buffers[i].tid = i;
+	}
+	start_ns = read_ns();
+	start_ticks = read_ticks();
+	return buffers;
+}
+
+/**
+	Records an event in the specified buffer. If the buffer is
+	full, the event is discarded and counted.
+	@param buf The buffer of the calling thread
+	@param name The event name, which must be a string literal
+	@param op The operation number
+	@param phase 'B' for the beginning of the event, 'E' for its end
+*/
+void trace_record(trace_buffer *buf, const char *name, int op, char phase) {
+	trace_event *event;
+
+	if (buf->count == buf->capacity) {
+		++buf->dropped;
+		return;
+	}
+	event = &buf->events[buf->count++];
+	event->ticks = read_ticks();
+	event->name = name;
+	event->op = op;
+	event->phase = phase;
+}
+
+/**
+	Writes the events of all the buffers on the specified file,
+	in the Chrome trace-event JSON format. Timestamps are converted 
+	to microseconds from the start of the trace.
+	@param pathname The trace file's path
+	@param buffers The buffers array
+	@param n_buffers The number of buffers
+*/
+void trace_write(const char *const pathname, trace_buffer *buffers, int n_buffers) {
+	char line[EVENT_BUF_SIZE];
+	double ticks_per_us;
+	uint64_t elapsed_ns;
+	trace_event *event;
+	int fd, i, j, dropped = 0;
+
+	elapsed_ns = read_ns() - start_ns;
+	ticks_per_us = elapsed_ns ? (read_ticks() - start_ticks) * 1000.0 / elapsed_ns : 1.0;
+
+	fd = open(pathname, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		write_to_fd(2, "Failed to open trace file\n");
+		exit(1);
+	}
+	write_to_fd(fd, "{\"traceEvents\":[\n");
+	for (i = 0; i < n_buffers; ++i) {
+		if (i == 0)
+			snprintf(line, EVENT_BUF_SIZE, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Main\"}}");
+		else
+			snprintf(line, EVENT_BUF_SIZE, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Processor #%d\"}}", i, i);
+		write_to_fd(fd, line);
+	}
+	for (i = 0; i < n_buffers; ++i) {
+		for (j = 0; j < buffers[i].count; ++j) {
+			event = &buffers[i].events[j];
+			snprintf(line, EVENT_BUF_SIZE, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"op\":%d}}", 
+				event->name, event->phase, (event->ticks - start_ticks) / ticks_per_us, buffers[i].tid, event->op);
+			write_to_fd(fd, line);
+		}
+		dropped += buffers[i].dropped;
+	}
+	write_to_fd(fd, "\n]}\n");
+
+	if (close(fd) == -1) {
+		write_to_fd(2, "Failed to close trace file\n");
+		exit(1);
+	}
+	if (dropped > 0)
+		write_with_int(2, "Trace events dropped: ", dropped);
+}
+
+/**
+	Deallocates the event buffers.
+	@param buffers The buffers array
+	@param n_buffers The number of buffers
+*/
+void trace_destruct(trace_buffer *buffers, int n_buffers) {
+	int i;
+
+	if (buffers) {
+		for (i = 0; i < n_buffers; ++i)
+			free(buffers[i].events);
+		free(buffers);
+	}
+}
+
+/**
+	Reads the CPU timestamp counter, falling back to the 
+	monotonic clock on other architectures.
+	@return The current timestamp, in ticks
+*/
+static uint64_t read_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return read_ns();
+#endif
+}
+
+/**
+	Reads the monotonic clock.
+	@return The current time, in nanoseconds
+*/
+static uint64_t read_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
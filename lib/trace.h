@@ -0,0 +1,68 @@
+/** @file
+	Public interface for the execution tracer.<br>
+	Events are recorded only when the project is built with 
+	@c ENABLE_TRACE (<tt>make TRACE=1</tt>); otherwise the 
+	tracing macros expand to nothing.
+	@see trace_buffer
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/// The maximum number of events recorded by a single thread
+#define TRACE_MAX_EVENTS (1 << 20)
+
+/// A single timeline event.
+typedef struct trace_event {
+	/// The timestamp, in timestamp counter ticks
+	uint64_t ticks;
+
+	/// The event name, a string literal
+	const char *name;
+
+	/// The operation number the event refers to
+	int op;
+
+	/// The event phase: 'B' (begin) or 'E' (end)
+	char phase;
+} trace_event;
+
+/// A preallocated buffer of events, owned by a single thread.
+typedef struct trace_buffer {
+	/// The recorded events
+	trace_event *events;
+
+	/// The number of recorded events
+	int count;
+
+	/// The maximum number of events
+	int capacity;
+
+	/// The number of events discarded because the buffer was full
+	int dropped;
+
+	/// The thread identifier shown in the timeline: 0 for the 
+	/// main thread, the processor ID otherwise
+	int tid;
+} trace_buffer;
+
+#ifdef ENABLE_TRACE
+/// Records the beginning of an event, if @c buf is not @c NULL
+#define TRACE_BEGIN(buf, name, op) \
+	do { if (buf) trace_record(buf, name, op, 'B'); } while (0)
+/// Records the end of an event, if @c buf is not @c NULL
+#define TRACE_END(buf, name, op) \
+	do { if (buf) trace_record(buf, name, op, 'E'); } while (0)
+#else
+#define TRACE_BEGIN(buf, name, op) ((void) 0)
+#define TRACE_END(buf, name, op) ((void) 0)
+#endif
+
+trace_buffer* trace_construct(int n_buffers, int capacity);
+void trace_record(trace_buffer *buf, const char *name, int op, char phase);
+void trace_write(const char *const pathname, trace_buffer *buffers, int n_buffers);
+void trace_destruct(trace_buffer *buffers, int n_buffers);
+
+#endif
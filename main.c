@@ -3,28 +3,75 @@
 	simulation setup and execution management.<br>
 	After setting up the data structures, 
 	the main thread does the following:<ul>
+	<li>Compiles the operations: each line holds an expression 
+	of 32 or 64 bit integers or of doubles, which processors 
+	evaluate as a whole with the kernel of its type
 	<li>Creates the required number of processor threads
 	<li>Dispatches each operation to the appropriate processor,
-	collecting the latest computed result
+	collecting the latest computed result. Operations are 
+	dispatched by priority class, as soon as a processor they 
+	can run on is free
+	<li>Reports the latency of each priority class
 	<li>Writes the results on the specified output file</ul>
+	With the <b>-b</b> option the results file is binary: it is
+	mapped in memory before the processors start, so that they 
+	store their results directly into it. Jobs made only of 32 bit
+	integer operations keep the compact format, where processors 
+	store @c int32_t results. The <b>-s</b> option also adds a 
+	status byte for each operation.<br>
+	When built with tracing support, the <b>-t</b> option writes 
+	a timeline of dispatch and computation events on the given file.
+	<br>With the <b>-p</b> option the processors run in the given 
+	number of worker processes (shards), each owning a subset of the 
+	processor IDs; operations and results are exchanged through 
+	shared memory.<br>
+	The <b>-c</b> option enables a cache of the given size, which 
+	resolves repeated operations without dispatching them.<br>
+	The <b>-j</b> and <b>-r</b> options give the setup and results 
+	files of a previous execution: only the operations which do not
+	appear in it are dispatched, the other results are copied.<br>
+	With the <b>-m</b> option pinning is only a preference: operations
+	waiting for a busy processor migrate to idle ones.<br>
+	With the <b>-o</b> option integer overflows are detected: the 
+	result wraps around and is flagged in its status byte, instead 
+	of being silently returned.
 */
 
 #include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include "expr.h"
 #include "io_utils.h"
 #include "list.h"
+#include "memo_cache.h"
+#include "op_index.h"
 #include "project_types.h"
+#include "scheduler.h"
+#include "shard.h"
 #include "sync_utils.h"
+#include "trace.h"
+
+/// The maximum length of a setup file line
+#define LINE_LENGTH 256
 
 void* processor_routine(void *arguments);
-static int find_proc(int *states, pthread_mutex_t *mutex);
 static list* parse_file(const char *const pathname);
-static void start_threads(pthread_t *threads, int n_threads, thread_args *args, pthread_mutex_t *mutexes, int *states, int *free_count, operation *operations, pthread_cond_t *conds);
+static int parse_header(char *cmd, value_type *type);
+static char* parse_type(char *src, value_type *type);
+static void parse_task(char *cmd, task *dest, int n_threads, value_type type, expr_arena *arena);
+static int reuse_results(task *tasks, int op_count, const char *const job_path, const char *const results_path, value *results);
+static void run_processors(task *tasks, int op_count, int n_threads, int shard, int n_shards, shard_ring *ring, int soft_pinning, int overflow_check, void *results, result_store store, unsigned char *status, uint64_t *finish, memo_cache *cache, trace_buffer *traces);
+static int run_shards(task *tasks, int op_count, int n_threads, int n_shards, int soft_pinning, int overflow_check, void *results, result_store store, unsigned char *status, uint64_t *finish, memo_cache *cache);
+static void resolve_cached(scheduler *sched, const task *tasks, memo_cache *cache, unsigned char *probed, void *results, result_store store, unsigned char *status, uint64_t *finish);
+static void restage_shard(int shard, const task *tasks, int op_count, int *owners, const unsigned char *status, scheduler *staged);
+static void start_threads(pthread_t *threads, int n_threads, int shard, int n_shards, int overflow_check, thread_args *args, pthread_mutex_t *mutexes, int *states, int *free_count, operation *operations, pthread_cond_t *conds, void *results, result_store store, unsigned char *status, uint64_t *finish, memo_cache *cache, trace_buffer *traces);
 
 /**
 	Carries out simulation setup and management.
@@ -32,28 +79,63 @@ static void start_threads(pthread_t *threads, int n_threads, thread_args *args,
 	@param argv The array of arguments
 */
 int main(int argc, char *argv[]) {
-	int *results, *states;
-	int i, op_count, processor_id, n_threads;
-	int free_count;
-	char *tmp_operator, *cmd;
+	value *reused = NULL;
+	void *results;
+	result_store store;
+	value_type type;
+	int i, op_count, n_threads, wide = 0, failed = 0;
+	int opt, binary = 0, with_status = 0, n_shards = 0, cache_kb = 0, soft_pinning = 0, overflow_check = 0;
+	unsigned char *types = NULL, *status = NULL;
+	char *cmd, *trace_path = NULL, *prev_job = NULL, *prev_results = NULL;
+	uint64_t start, *finish;
 	list *commands;
-	operation *operations;
-	pthread_cond_t *conds;
-	pthread_mutex_t *mutexes;
-	pthread_t *threads;
-	thread_args *arguments;
+	task *tasks;
+	expr_arena *arena;
+	memo_cache *cache = NULL;
+	trace_buffer *traces = NULL;
 	
-	if(argc != 3) {
-		write_to_fd(2, "Usage: main.x <source file> <results file>\n");
+	while ((opt = getopt(argc, argv, "bc:j:mop:r:st:")) != -1) {
+		switch (opt) {
+			case 'c': cache_kb = atoi(optarg);
+				  if (cache_kb <= 0)
+					argc = 0;
+				  break;
+			case 's': with_status = 1; /* fall through */
+			case 'b': binary = 1; break;
+			case 'p': n_shards = atoi(optarg); 
+				  if (n_shards <= 0)
+					argc = 0;
+				  break;
+			case 'j': prev_job = optarg; break;
+			case 'm': soft_pinning = 1; break;
+			case 'o': overflow_check = 1; break;
+			case 'r': prev_results = optarg; break;
+			case 't': trace_path = optarg; break;
+			default: argc = 0;
+		}
+	}
+	if(argc - optind != 2 || !prev_job != !prev_results) {
+		write_to_fd(2, "Usage: main.x [-b] [-s] [-m] [-o] [-c <cache KB>] [-j <previous source file> -r <previous results file>] [-p <shards>] [-t <trace file>] <source file> <results file>\n");
 		exit(1);
 	}
-	commands = parse_file(argv[1]);
-	n_threads = atoi(list_extract(commands));
+#ifndef ENABLE_TRACE
+	if (trace_path) {
+		write_to_fd(2, "Tracing not available: rebuild with make TRACE=1\n");
+		exit(1);
+	}
+#endif
+	if (trace_path && n_shards) {
+		write_to_fd(2, "Tracing is not available with shards\n");
+		exit(1);
+	}
+	commands = parse_file(argv[optind]);
+	cmd = list_extract(commands);
+	n_threads = cmd ? parse_header(cmd, &type) : 0;
+	free(cmd);
 	if (n_threads <= 0) {
 		write_to_fd(2, "Invalid number of threads\n");
 		exit(1);
 	}
-	free_count = n_threads;
 	write_with_int(1, "Number of threads: ", n_threads);
 	op_count = list_count(commands);
 	if (op_count == 0) {
@@ -61,15 +143,157 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 	write_with_int(1, "Number of operations: ", op_count);		
+	if (n_shards > n_threads)
+		n_shards = n_threads;
 	
-	results = (int *) malloc(op_count * sizeof(int));
+	tasks = (task *) malloc(op_count * sizeof(task));
+	if (!tasks) {
+		write_to_fd(2, "Failed to allocate operations\n");
+		exit(1);
+	}
+	arena = arena_construct();
+	for (i = 0; i < op_count; ++i) {
+		cmd = list_extract(commands);
+		parse_task(cmd, &tasks[i], n_threads, type, arena);
+		free(cmd);
+	}
+	list_destruct(commands);
+	if (prev_job) {
+		reused = (value *) malloc(op_count * sizeof(value));
+		if (!reused) {
+			write_to_fd(2, "Failed to allocate results\n");
+			exit(1);
+		}
+		write_with_int(1, "Reused results: ", reuse_results(tasks, op_count, prev_job, prev_results, reused));
+	}
+	
+	for (i = 0; i < op_count; ++i)
+		wide |= tasks[i].oper.type != TYPE_I32;
+	if (binary) {
+		results = map_results(argv[optind + 1], op_count, wide, with_status);
+		types = results_types(results, op_count);
+		status = results_status(results, op_count);
+	} else {
+		if (n_shards)
+			results = shared_alloc(op_count * sizeof(value));
+		else
+			results = malloc(op_count * sizeof(value));
+		types = (unsigned char *) malloc(op_count * sizeof(unsigned char));
+	}
+	store = binary && !wide ? store_int32 : store_value;
+	if (n_shards) {
+		if (!status)
+			status = (unsigned char *) shared_alloc(op_count * sizeof(unsigned char));
+		finish = (uint64_t *) shared_alloc(op_count * sizeof(uint64_t));
+	} else
+		finish = (uint64_t *) malloc(op_count * sizeof(uint64_t));
+	if (!results || (!binary && !types) || !finish) {
+		write_to_fd(2, "Failed to allocate results\n");
+		exit(1);
+	}
+	for (i = 0; i < op_count; ++i) {
+		if (types)
+			types[i] = tasks[i].oper.type;
+		if (tasks[i].done) {
+			store(results, i, reused[i]);
+			if (status)
+				status[i] = RESULT_OK;
+		}
+	}
+	free(reused);
+	if (trace_path)
+		traces = trace_construct(n_threads + 1, 8 * (op_count + 1));
+	if (cache_kb)
+		cache = memo_construct((size_t) cache_kb * 1024);
+	
+	start = scheduler_clock();
+	if (n_shards)
+		failed = run_shards(tasks, op_count, n_threads, n_shards, soft_pinning, overflow_check, results, store, status, finish, cache);
+	else
+		run_processors(tasks, op_count, n_threads, 0, 1, NULL, soft_pinning, overflow_check, results, store, status, finish, cache, traces);
+
+	for (i = 0; i < op_count; ++i)
+		finish[i] -= start;
+	scheduler_report(tasks, status, finish, op_count);
+	free(tasks);
+	arena_destruct(arena);
+	if (cache) {
+		memo_report(cache);
+		memo_destruct(cache);
+	}
+	if (traces) {
+		write_to_fd(1, "\nWriting trace file\n");
+		trace_write(trace_path, traces, n_threads + 1);
+		trace_destruct(traces, n_threads + 1);
+	}
+	if (n_shards) {
+		shared_free(finish, op_count * sizeof(uint64_t));
+		if (!with_status)
+			shared_free(status, op_count * sizeof(unsigned char));
+	} else
+		free(finish);
+	if (binary) {
+		write_to_fd(1, "\nAll threads exited. Unmapping output file\n");
+		unmap_results(results);
+	} else {
+		write_to_fd(1, "\nAll threads exited. Writing output file\n");
+		write_results(argv[optind + 1], (value *) results, types, op_count);
+		free(types);
+		if (n_shards)
+			shared_free(results, op_count * sizeof(value));
+		else
+			free(results);
+	}
+	exit(failed ? 1 : 0);
+}
+
+/**
+	Creates the processor threads and dispatches the operations to 
+	them, by priority class, as soon as a processor they can run on 
+	is free. Then terminates the processors.<br>
+	When running in a shard, the processors are the ones whose ID 
+	modulo @c n_shards is @c shard, and the operations are received 
+	from a ring; otherwise all the operations are dispatched.<br>
+	With the cache enabled, each operation is looked up once, when 
+	it reaches the head of its queue: if its result is cached, it is
+	completed without waiting for a processor.
+	@param tasks The operations
+	@param op_count The number of operations
+	@param n_threads The number of processors to create
+	@param shard The shard index, 0 if not running in a shard
+	@param n_shards The number of shards, 1 if not running in a shard
+	@param ring The ring the operations are received from, @c NULL 
+	if not running in a shard
+	@param soft_pinning Whether pinned operations can migrate to 
+	other processors when theirs is overloaded
+	@param overflow_check Whether processors detect integer overflows
+	@param results The results array
+	@param store Stores a result in the results array
+	@param status The results status bytes, @c NULL if not kept
+	@param finish The array of completion times
+	@param cache The cache consulted before dispatching, @c NULL if disabled
+	@param traces The trace buffers, @c NULL if tracing is disabled
+*/
+static void run_processors(task *tasks, int op_count, int n_threads, int shard, int n_shards, shard_ring *ring, int soft_pinning, int overflow_check, void *results, result_store store, unsigned char *status, uint64_t *finish, memo_cache *cache, trace_buffer *traces) {
+	int *states;
+	int i, processor_id, free_count = n_threads;
+	unsigned char *probed = NULL;
+	operation *operations;
+	scheduler *sched;
+	pthread_cond_t *conds;
+	pthread_mutex_t *mutexes;
+	pthread_t *threads;
+	thread_args *arguments;
+
 	conds = (pthread_cond_t *) malloc((2 * n_threads + 1) * sizeof(pthread_cond_t));
 	mutexes = (pthread_mutex_t *) malloc((2 * n_threads + 1) * sizeof(pthread_mutex_t));
 	threads = (pthread_t *) malloc(n_threads * sizeof(pthread_t));
 	operations = (operation *) malloc(n_threads * sizeof(operation));
 	states = (int *) malloc(n_threads * sizeof(int));
 	arguments = (thread_args *) malloc(n_threads * sizeof(thread_args));
-	if (!results || !conds || !mutexes || !threads || !operations || !states || !arguments) {
+	if (cache)
+		probed = (unsigned char *) calloc(op_count, sizeof(unsigned char));
+	if (!conds || !mutexes || !threads || !operations || !states || !arguments || (cache && !probed)) {
 		write_to_fd(2, "Failed to allocate auxiliary data structures\n");
 		exit(1);
 	}
@@ -79,58 +303,75 @@ int main(int argc, char *argv[]) {
 	for (i = 0; i < n_threads; ++i)
 		states[i] = 0;
 
-	start_threads(threads, n_threads, arguments, mutexes, states, &free_count, operations, conds);
-	for (i = 1; list_count(commands) > 0; ++i) {
-		cmd = list_extract(commands);
-		write_with_int(1, "\nOperation #", i);
-		processor_id = atoi(strtok(cmd, " "));
+	sched = scheduler_construct(op_count, n_threads, soft_pinning);
+	if (!ring) {
+		for (i = 0; i < op_count; ++i) {
+			if (!tasks[i].done)
+				scheduler_push(sched, i, tasks[i].processor, tasks[i].priority);
+		}
+	}
+
+	start_threads(threads, n_threads, shard, n_shards, overflow_check, arguments, mutexes, states, &free_count, operations, conds, results, store, status, finish, cache, traces);
+	while (1) {
+		if (ring) {
+			while ((i = ring_pop(ring, scheduler_count(sched) == 0)) != -1)
+				scheduler_push(sched, i, tasks[i].processor == ANY_PROCESSOR ? ANY_PROCESSOR : tasks[i].processor / n_shards, tasks[i].priority);
+		}
+		if (scheduler_count(sched) == 0)
+			break;
+		if (cache) {
+			resolve_cached(sched, tasks, cache, probed, results, store, status, finish);
+			if (scheduler_count(sched) == 0)
+				continue;
+		}
 		mutex_lock(&mutexes[2 * n_threads]);
-		while (free_count == 0)
-			cond_wait(&conds[2 * n_threads], &mutexes[2 * n_threads]);
+		TRACE_BEGIN(traces, "schedule", 0);
+		while (free_count == 0 || (i = scheduler_next(sched, states, &processor_id)) == -1) {
+			if (free_count == 0) {
+				TRACE_BEGIN(traces, "wait free", 0);
+				cond_wait(&conds[2 * n_threads], &mutexes[2 * n_threads]);
+				TRACE_END(traces, "wait free", 0);
+			} else {
+				TRACE_BEGIN(traces, "wait processor", 0);
+				cond_wait(&conds[2 * n_threads], &mutexes[2 * n_threads]);
+				TRACE_END(traces, "wait processor", 0);
+			}
+		}
+		TRACE_END(traces, "schedule", i + 1);
 		--free_count;
 		mutex_unlock(&mutexes[2 * n_threads]);
-		if (processor_id-- == 0) {
-			processor_id = find_proc(states, &mutexes[2 * n_threads]);
-		}
-		write_with_int(1, "Waiting for processor ", processor_id + 1);
+		TRACE_BEGIN(traces, "deliver", i + 1);
+		write_with_int(1, "\nOperation #", i + 1);
 		mutex_lock(&mutexes[2 * processor_id]);
-		while (states[processor_id] > 0)
-			cond_wait(&conds[2 * processor_id], &mutexes[2 * processor_id]);
-		write_with_int(1, "Delivering operation to processor ", processor_id + 1);
-		if (states[processor_id] != 0) {
-			results[(states[processor_id] + 1) * -1] = operations[processor_id].num1;
-			write_with_int(1, "Previous result: ", operations[processor_id].num1);
-		}
-		operations[processor_id].num1 = atoi(strtok(NULL, " "));
-		tmp_operator = strtok(NULL, " ");
-		operations[processor_id].op = *tmp_operator;
-		operations[processor_id].num2 = atoi(strtok(NULL, " "));
-		states[processor_id] = i;
-		write_with_int(1, "Operation delivered. Unblocking processor ", processor_id + 1);
+		write_with_int(1, "Delivering operation to processor ", shard + processor_id * n_shards + 1);
+		if (states[processor_id] != 0)
+			write_with_value(1, "Previous result: ", operations[processor_id].num1, operations[processor_id].type);
+		operations[processor_id] = tasks[i].oper;
+		states[processor_id] = i + 1;
+		write_with_int(1, "Operation delivered. Unblocking processor ", shard + processor_id * n_shards + 1);
 		cond_wait(&conds[2 * processor_id + 1], &mutexes[2 * processor_id + 1]);
 		mutex_unlock(&mutexes[2 * processor_id]);
-		free(cmd);
+		TRACE_END(traces, "deliver", i + 1);
 	}
-	
-	list_destruct(commands);
+	if (soft_pinning)
+		write_with_int(1, "\nMigrated operations: ", scheduler_migrations(sched));
+	scheduler_destruct(sched);
 	
 	for (i = 0; i < n_threads; ++i) {
 		mutex_lock(&mutexes[2 * i]);
 		while (states[i] > 0)
 			cond_wait(&conds[2 * i], &mutexes[2 * i]);
 		mutex_unlock(&mutexes[2 * i + 1]);
-		write_with_int(1, "\nPassing termination command to processor #", i + 1);
-		if (states[i] != 0) {
-			results[(states[i] + 1) * -1] = operations[i].num1;
-			write_with_int(1, "Last result: ", operations[i].num1);
-		}
+		write_with_int(1, "\nPassing termination command to processor #", shard + i * n_shards + 1);
+		if (states[i] != 0)
+			write_with_value(1, "Last result: ", operations[i].num1, operations[i].type);
 		operations[i].op = 'K';
 		mutex_unlock(&mutexes[2 * i]);
 	}
 
 	for (i = 0; i < n_threads; ++i) {
 		if (pthread_join(threads[i], NULL) != 0)
-			write_with_int(2, "Failed to join thread ", i + 1);
+			write_with_int(2, "Failed to join thread ", shard + i * n_shards + 1);
 		mutex_destroy(&mutexes[2 * i]);
 		mutex_destroy(&mutexes[2 * i + 1]);
 	}
@@ -142,31 +383,210 @@ int main(int argc, char *argv[]) {
 	free(arguments);
 	free(operations);
 	free(states);		
-	write_to_fd(1, "\nAll threads exited. Writing output file\n");
-	write_results(argv[2], results, op_count);
-	free(results);
-	exit(0);
+	free(probed);
+}
+
+/**
+	Looks up the operations which reached the head of a scheduler 
+	queue since the last call, completing the ones whose result is 
+	cached, until every head is a cache miss. Each operation is 
+	looked up only once. Runs without holding any lock of the 
+	processors.
+	@param sched The scheduler
+	@param tasks The operations
+	@param cache The cache
+	@param probed Nonzero for each operation already looked up
+	@param results The results array
+	@param store Stores a result in the results array
+	@param status The results status bytes, @c NULL if not kept
+	@param finish The array of completion times
+*/
+static void resolve_cached(scheduler *sched, const task *tasks, memo_cache *cache, unsigned char *probed, void *results, result_store store, unsigned char *status, uint64_t *finish) {
+	int i, q;
+	value result;
+
+	for (q = 0; q < scheduler_queues(sched); ++q) {
+		while ((i = scheduler_head(sched, q)) != -1 && !probed[i]) {
+			probed[i] = 1;
+			if (!memo_lookup(cache, &tasks[i].oper, &result))
+				break;
+			scheduler_take(sched, q);
+			store(results, i, result);
+			if (status)
+				status[i] = RESULT_OK;
+			finish[i] = scheduler_clock();
+		}
+	}
+}
+
+/**
+	Stages again the operations sent to a terminated shard which can
+	run on any processor and were not computed, whether they were 
+	still in its ring or already received. The ones pinned to the 
+	shard's processors are left uncomputed.
+	@param shard The terminated shard
+	@param tasks The operations
+	@param op_count The number of operations
+	@param owners The shard each operation was sent to, -1 if none
+	@param status The results status bytes
+	@param staged The scheduler holding the operations to send
+*/
+static void restage_shard(int shard, const task *tasks, int op_count, int *owners, const unsigned char *status, scheduler *staged) {
+	int i;
+
+	for (i = 0; i < op_count; ++i) {
+		if (owners[i] == shard && tasks[i].processor == ANY_PROCESSOR && status[i] == RESULT_PENDING) {
+			scheduler_push(staged, i, ANY_PROCESSOR, tasks[i].priority);
+			owners[i] = -1;
+		}
+	}
 }
 
 /**
-	Searches the processor state array for a free processor (state <= 0).
-	@param states The array of processor states. Each cell <i>i</i> contains a 
-	key such that:<br>
-	<ul><li>If <b>key < 0</b>, processor has completed the |key|-th operation
-	<li>If <b>key == 0</b>, processor has not received an operation yet
-	<li>If <b>key > 0</b>, processor is currently working on the key-th operation</ul>
-	@param mutex The mutex which protects the states array
-	@return The ID of a free processor
+	Runs the processors in separate worker processes (shards): shard 
+	<i>k</i> owns the processors whose ID modulo @c n_shards is <i>k</i>.
+	<br>Operations are staged in a scheduler with a queue per shard and
+	sent to the shards through rings, by priority class; the ones 
+	which can run anywhere are distributed round robin. A full ring 
+	does not stall the others: operations keep flowing to the shards
+	which have room, and the main process only waits for a full ring
+	when no other shard can take work. A shard found terminated is 
+	skipped from then on: the operations which can run anywhere, 
+	including the ones it received but did not compute, go to the 
+	other shards. Results must be in shared 
+	memory.<br>
+	A shard terminating abnormally does not affect the others: its 
+	pending operations are left uncomputed and reported.
+	@param tasks The operations
+	@param op_count The number of operations
+	@param n_threads The total number of processors
+	@param n_shards The number of shards
+	@param soft_pinning Whether pinned operations can migrate to 
+	other processors of the same shard
+	@param overflow_check Whether processors detect integer overflows
+	@param results The results array
+	@param store Stores a result in the results array
+	@param status The results status bytes
+	@param finish The array of completion times
+	@param cache The cache consulted before dispatching, @c NULL if disabled
+	@return The number of operations not computed
 */
-static int find_proc(int *states, pthread_mutex_t *mutex) {
-	int i = 0;
-
-	mutex_lock(mutex);
-	write_to_fd(1, "Looking for a free processor\n");
-	while(states[i++] > 0);
-	mutex_unlock(mutex);
-	write_with_int(1, "Found processor ", i);
-	return i - 1;
+static int run_shards(task *tasks, int op_count, int n_threads, int n_shards, int soft_pinning, int overflow_check, void *results, result_store store, unsigned char *status, uint64_t *finish, memo_cache *cache) {
+	int i, k, c, wstatus, refilled, next_any = 0, next_full = 0, alive = n_shards, failed = 0;
+	int *active, *full, *room, *owners;
+	shard_ring **rings;
+	scheduler *staged;
+	pid_t *pids;
+	value none;
+
+	rings = (shard_ring **) malloc(n_shards * sizeof(shard_ring *));
+	pids = (pid_t *) malloc(n_shards * sizeof(pid_t));
+	active = (int *) malloc(n_shards * sizeof(int));
+	full = (int *) malloc(n_shards * sizeof(int));
+	room = (int *) malloc(n_shards * sizeof(int));
+	owners = (int *) malloc(op_count * sizeof(int));
+	if (!rings || !pids || !active || !full || !room || !owners) {
+		write_to_fd(2, "Failed to allocate shards\n");
+		exit(1);
+	}
+	for (k = 0; k < n_shards; ++k)
+		rings[k] = ring_construct(RING_CAPACITY);
+	for (k = 0; k < n_shards; ++k) {
+		pids[k] = fork();
+		if (pids[k] == -1) {
+			write_with_int(2, "Failed to start shard ", k + 1);
+			exit(1);
+		}
+		if (pids[k] == 0) {
+			prctl(PR_SET_PDEATHSIG, SIGKILL);
+			run_processors(tasks, op_count, (n_threads - k + n_shards - 1) / n_shards, k, n_shards, rings[k], soft_pinning, overflow_check, results, store, status, finish, cache, NULL);
+			exit(0);
+		}
+		active[k] = 1;
+		full[k] = 0;
+		room[k] = RING_CAPACITY;
+		write_with_int(1, "Started shard ", k + 1);
+	}
+
+	staged = scheduler_construct(op_count, n_shards, 0);
+	for (i = 0; i < op_count; ++i) {
+		owners[i] = -1;
+		if (!tasks[i].done)
+			scheduler_push(staged, i, tasks[i].processor == ANY_PROCESSOR ? ANY_PROCESSOR : tasks[i].processor % n_shards, tasks[i].priority);
+	}
+	while (scheduler_count(staged) > 0 && alive > 0) {
+		i = scheduler_next(staged, full, &k);
+		if (i != -1) {
+			if (tasks[i].processor == ANY_PROCESSOR) {
+				do
+					k = next_any++ % n_shards;
+				while (full[k]);
+			}
+			if (ring_push(rings[k], i, pids[k]) == -1) {
+				if (tasks[i].processor == ANY_PROCESSOR)
+					scheduler_push(staged, i, ANY_PROCESSOR, tasks[i].priority);
+				restage_shard(k, tasks, op_count, owners, status, staged);
+				write_with_int(2, "Shard stopped responding: ", k + 1);
+				active[k] = 0;
+				full[k] = 1;
+				--alive;
+			} else {
+				owners[i] = k;
+				full[k] = --room[k] == 0;
+			}
+			continue;
+		}
+		refilled = 0;
+		for (k = 0; k < n_shards; ++k) {
+			if (active[k] && full[k]) {
+				room[k] = ring_room(rings[k], pids[k], 0);
+				full[k] = room[k] == 0;
+				refilled |= !full[k];
+			}
+		}
+		if (refilled)
+			continue;
+		for (c = 0; c < n_shards && !(active[(next_full + c) % n_shards] && full[(next_full + c) % n_shards]); ++c);
+		if (c == n_shards)
+			break;
+		k = (next_full + c) % n_shards;
+		next_full = k + 1;
+		room[k] = ring_room(rings[k], pids[k], 1);
+		if (room[k] == -1) {
+			restage_shard(k, tasks, op_count, owners, status, staged);
+			write_with_int(2, "Shard stopped responding: ", k + 1);
+			active[k] = 0;
+			--alive;
+		} else
+			full[k] = 0;
+	}
+	scheduler_destruct(staged);
+	for (k = 0; k < n_shards; ++k)
+		ring_close(rings[k]);
+
+	for (k = 0; k < n_shards; ++k) {
+		if (waitpid(pids[k], &wstatus, 0) == -1)
+			write_with_int(2, "Failed to wait for shard ", k + 1);
+		else if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0)
+			write_with_int(2, "Shard terminated abnormally: ", k + 1);
+		ring_destruct(rings[k]);
+	}
+	none.i = 0;
+	for (i = 0; i < op_count; ++i) {
+		if (status[i] == RESULT_PENDING) {
+			store(results, i, none);
+			++failed;
+		}
+	}
+	if (failed > 0)
+		write_with_int(2, "Operations not computed: ", failed);
+	free(rings);
+	free(pids);
+	free(active);
+	free(full);
+	free(room);
+	free(owners);
+	return failed;
 }
 
 /**
@@ -178,7 +598,7 @@ static int find_proc(int *states, pthread_mutex_t *mutex) {
 */
 static list* parse_file(const char *const pathname) {
 	list *result = list_construct();
-	char line[50];
+	char line[LINE_LENGTH];
 	int len, fd;
 	
 	if(result == NULL) 
@@ -191,7 +611,7 @@ static list* parse_file(const char *const pathname) {
 	}
 		
 	do {
-		len = read_line(fd, line, 50);
+		len = read_line(fd, line, LINE_LENGTH);
 		if (len > 0)
 			list_append(result, line);
 	} while(len >= 0);
@@ -204,34 +624,203 @@ static list* parse_file(const char *const pathname) {
 	return result;
 }
 
+/**
+	Parses the first line of the setup file, which has the format
+	<tt>threads [type]</tt>.
+	@param cmd The line to parse
+	@param type Where to store the default type of the operations,
+	@c TYPE_I32 if not given
+	@return The number of threads, 0 if the line is invalid
+	@see parse_type
+*/
+static int parse_header(char *cmd, value_type *type) {
+	char *pos;
+	int n_threads;
+
+	*type = TYPE_I32;
+	n_threads = strtol(cmd, &pos, 10);
+	if (pos == cmd)
+		return 0;
+	pos = parse_type(pos, type);
+	while (*pos == ' ' || *pos == '\t' || *pos == '\r')
+		++pos;
+	return *pos == '\0' ? n_threads : 0;
+}
+
+/**
+	Parses an optional type name: <tt>i32</tt>, <tt>i64</tt> or 
+	<tt>f64</tt>, followed by a blank or by the end of the line.
+	@param src The string to parse
+	@param type Where to store the type, left unchanged if not given
+	@return The position after the type name, @c src if not given
+*/
+static char* parse_type(char *src, value_type *type) {
+	static const char *const names[N_TYPES] = { "i32", "i64", "f64" };
+	char *pos = src;
+	int i;
+
+	while (*pos == ' ' || *pos == '\t')
+		++pos;
+	for (i = 0; i < N_TYPES; ++i) {
+		if (strncmp(pos, names[i], 3) == 0 && 
+			(pos[3] == ' ' || pos[3] == '\t' || pos[3] == '\r' || pos[3] == '\0')) {
+			*type = (value_type) i;
+			return pos + 3;
+		}
+	}
+	return src;
+}
+
+/**
+	Parses an operation line of the setup file, which has the format
+	<tt>processor [type] expression [priority]</tt>.<br>
+	A processor ID of 0 means that the operation can run on any 
+	processor; the type defaults to the one of the setup file and
+	the priority class to 0, the lowest. The expression is either 
+	a single binary operation, <tt>num1 op num2</tt>, or any 
+	expression, which is compiled into bytecode.
+	@param cmd The line to parse
+	@param dest Where to store the parsed operation
+	@param n_threads The number of processors
+	@param type The default type of the operations
+	@param arena The arena where expression bytecode is stored
+	@see expr_compile
+*/
+static void parse_task(char *cmd, task *dest, int n_threads, value_type type, expr_arena *arena) {
+	char *pos, *end;
+
+	dest->processor = strtol(cmd, &pos, 10) - 1;
+	if (pos == cmd || dest->processor < ANY_PROCESSOR || dest->processor >= n_threads) {
+		write_to_fd(2, "Invalid processor ID\n");
+		exit(1);
+	}
+	pos = parse_type(pos, &type);
+	pos = expr_compile(pos, type, arena, &dest->oper);
+	if (!pos) {
+		write_to_fd(2, "Invalid expression\n");
+		exit(1);
+	}
+	dest->priority = strtol(pos, &end, 10);
+	while (*end == ' ' || *end == '\t' || *end == '\r')
+		++end;
+	dest->done = 0;
+	if (*end != '\0' || dest->priority < 0 || dest->priority >= PRIORITY_CLASSES) {
+		write_to_fd(2, "Invalid priority class\n");
+		exit(1);
+	}
+}
+
+/**
+	Copies the results of the operations which also appear in a 
+	previous setup file, marking them as done. Operations are matched
+	by their type, operands and operator, so lines may have been 
+	moved, added or removed.<br>
+	It must run before the results file is created, since it may be
+	the previous results file itself.
+	@param tasks The operations
+	@param op_count The number of operations
+	@param job_path The previous setup file's path
+	@param results_path The previous results file's path
+	@param results Where to store the reused results
+	@return The number of reused results
+*/
+static int reuse_results(task *tasks, int op_count, const char *const job_path, const char *const results_path, value *results) {
+	int i, n_threads, prev_count, reused = 0;
+	value *prev_results;
+	value_type type;
+	unsigned char *prev_types, *prev_status;
+	char *cmd;
+	list *commands;
+	expr_arena *arena;
+	op_index *idx;
+	task *prev;
+
+	commands = parse_file(job_path);
+	cmd = list_extract(commands);
+	n_threads = cmd ? parse_header(cmd, &type) : 0;
+	free(cmd);
+	prev_count = list_count(commands);
+	prev = (task *) malloc(prev_count * sizeof(task));
+	prev_types = (unsigned char *) malloc(prev_count * sizeof(unsigned char));
+	if (!prev || !prev_types) {
+		write_to_fd(2, "Failed to allocate previous operations\n");
+		exit(1);
+	}
+	arena = arena_construct();
+	for (i = 0; i < prev_count; ++i) {
+		cmd = list_extract(commands);
+		parse_task(cmd, &prev[i], n_threads, type, arena);
+		prev_types[i] = prev[i].oper.type;
+		free(cmd);
+	}
+	list_destruct(commands);
+	prev_results = read_results(results_path, prev_count, prev_types, &prev_status);
+
+	idx = index_construct(prev_count);
+	for (i = 0; i < prev_count; ++i) {
+		if (!prev_status || prev_status[i] == RESULT_OK)
+			index_insert(idx, &prev[i].oper, prev_results[i]);
+	}
+	free(prev);
+	free(prev_types);
+	free(prev_results);
+	free(prev_status);
+
+	for (i = 0; i < op_count; ++i) {
+		if (index_lookup(idx, &tasks[i].oper, &results[i])) {
+			tasks[i].done = 1;
+			++reused;
+		}
+	}
+	index_destruct(idx);
+	arena_destruct(arena);
+	return reused;
+}
+
 /**
 	Creates the required number of threads.
 	@param threads The threads array
 	@param n_threads The number of threads
+	@param shard The shard index, 0 if not running in a shard
+	@param n_shards The number of shards, 1 if not running in a shard
+	@param overflow_check Whether processors detect integer overflows
 	@param args The array of thread arguments
 	@param mutexes The array of mutexes
 	@param states The array of processor states
 	@param free_count The number of available threads
 	@param operations The array of operations
 	@param conds The array of condition variable
+	@param results The results array
+	@param store Stores a result in the results array
+	@param status The results status bytes, @c NULL if not kept
+	@param finish The array of completion times
+	@param cache The cache where results are stored, @c NULL if disabled
+	@param traces The trace buffers, @c NULL if tracing is disabled
 	@see thread_args
 */
-static void start_threads(pthread_t *threads, int n_threads, thread_args *args, pthread_mutex_t *mutexes, int *states, int *free_count, operation *operations, pthread_cond_t *conds) {
+static void start_threads(pthread_t *threads, int n_threads, int shard, int n_shards, int overflow_check, thread_args *args, pthread_mutex_t *mutexes, int *states, int *free_count, operation *operations, pthread_cond_t *conds, void *results, result_store store, unsigned char *status, uint64_t *finish, memo_cache *cache, trace_buffer *traces) {
 	int i;
 	
 	for (i = 0; i < n_threads; ++i) {
-		args[i].processor_id = i;
+		args[i].processor_id = shard + i * n_shards;
 		args[i].mutexA = &mutexes[2 * i];
 		args[i].mutexB = &mutexes[2 * i + 1];
 		args[i].oper = &operations[i];
 		args[i].state = &states[i];
+		args[i].results = results;
+		args[i].store = store;
+		args[i].status = status;
+		args[i].finish = finish;
+		args[i].cache = cache;
+		args[i].overflow_check = overflow_check;
 		args[i].free_count = free_count;
 		args[i].free_cond = &conds[2 * n_threads];
 		args[i].free_cond_mutex = &mutexes[2 * n_threads];
 		args[i].received_cond = &conds[2 * i + 1];
 		args[i].ready_cond = &conds[2 * i];
+		args[i].trace = traces ? &traces[i + 1] : NULL;
 		if (pthread_create(&threads[i], NULL, processor_routine, (void *) &args[i]) != 0) {
-			write_with_int(2, "Failed to create thread ", i + 1);
+			write_with_int(2, "Failed to create thread ", shard + i * n_shards + 1);
 		}
 	}
 }
@@ -1,20 +1,125 @@
 /** @file
-	Code for the child processor, which is
-	started by the main process.<br>
-	Each processor is launched passing its ID and the
-	total number of semaphores: with this information the
-	processor can synchronize on the correct semaphore.<br>
-	After attaching the shared memory segments, it loops
-	while there are operations to compute, and writes the 
-	results in the operations array.
+	Code for the processor threads, which are started by the
+	main thread, or by the main thread of a shard process.<br>
+	Each processor is launched with its own arguments: its ID, the
+	mutexes and condition variables of its handoff with the main
+	thread, and the shared arrays where it stores results.<br>
+	It loops while there are operations to compute, storing each
+	result in the results array and signaling the main thread that
+	it is free again. When running in a shard, the results array
+	is in shared memory, so results reach the main process directly.<br>
+	Operations are computed by kernels specialized for each type 
+	at compile time, which are selected through a table.
 */
 
+#include <stdint.h>
 #include <stdlib.h>
+#include "expr.h"
 #include "io_utils.h"
+#include "memo_cache.h"
 #include "project_types.h"
+#include "scheduler.h"
 #include "sync_utils.h"
+#include "trace.h"
 
-static void compute(operation *oper);
+/// Computes the operation, stores the result in the first operand 
+/// field and returns nonzero if an integer overflow occurred
+typedef int (*kernel)(operation *oper);
+
+static void division_by_zero();
+static void invalid_operator();
+
+/// Adds two integers, wrapping around and flagging overflow
+#define INT_ADD(min, a, b, r, ov) ov |= __builtin_add_overflow(a, b, &(r))
+/// Subtracts two integers, wrapping around and flagging overflow
+#define INT_SUB(min, a, b, r, ov) ov |= __builtin_sub_overflow(a, b, &(r))
+/// Multiplies two integers, wrapping around and flagging overflow
+#define INT_MUL(min, a, b, r, ov) ov |= __builtin_mul_overflow(a, b, &(r))
+/// Divides two integers: the only overflow is @c min / -1, which wraps to @c min
+#define INT_DIV(min, a, b, r, ov) do { \
+		if ((b) == 0) \
+			division_by_zero(); \
+		if ((b) == -1 && (a) == (min)) { \
+			r = min; \
+			ov = 1; \
+		} else \
+			r = (a) / (b); \
+	} while (0)
+/// Negates an integer: the opposite of @c min wraps to @c min
+#define INT_NEG(min, a, ov) do { \
+		if ((a) == (min)) \
+			ov = 1; \
+		else \
+			a = -(a); \
+	} while (0)
+
+/// Adds two floating point numbers
+#define FLT_ADD(min, a, b, r, ov) r = (a) + (b)
+/// Subtracts two floating point numbers
+#define FLT_SUB(min, a, b, r, ov) r = (a) - (b)
+/// Multiplies two floating point numbers
+#define FLT_MUL(min, a, b, r, ov) r = (a) * (b)
+/// Divides two floating point numbers, following IEEE 754 for 0 divisors
+#define FLT_DIV(min, a, b, r, ov) r = (a) / (b)
+/// Negates a floating point number
+#define FLT_NEG(min, a, ov) a = -(a)
+
+/**
+	Defines the kernels of a type: @c execute_<name>, which evaluates
+	compiled expressions, and @c compute_<name>, which computes an 
+	operation. Both are specialized for the C type @c ctype, stored 
+	in the @c field member of @ref value, with the arithmetic of the 
+	@c ARITH family (@c INT or @c FLT). If @c checked is 0, overflow
+	is never reported.
+*/
+#define DEFINE_KERNELS(name, ctype, field, ARITH, min, checked) \
+	static int execute_##name(const int64_t *code, ctype *result) { \
+		ctype stack[EXPR_MAX_DEPTH]; \
+		ctype *top = stack - 1; \
+		int overflow = 0; \
+		value imm; \
+		\
+		while (1) { \
+			switch (*code++) { \
+				case EXPR_PUSH: imm.i = *code++; *++top = (ctype) imm.field; break; \
+				case EXPR_ADD: ARITH##_ADD(min, top[-1], top[0], top[-1], overflow); --top; break; \
+				case EXPR_SUB: ARITH##_SUB(min, top[-1], top[0], top[-1], overflow); --top; break; \
+				case EXPR_MUL: ARITH##_MUL(min, top[-1], top[0], top[-1], overflow); --top; break; \
+				case EXPR_DIV: ARITH##_DIV(min, top[-1], top[0], top[-1], overflow); --top; break; \
+				case EXPR_NEG: ARITH##_NEG(min, top[0], overflow); break; \
+				case EXPR_END: *result = top[0]; return checked && overflow; \
+				default: invalid_operator(); \
+			} \
+		} \
+	} \
+	\
+	static int compute_##name(operation *oper) { \
+		ctype a = (ctype) oper->num1.field, b = (ctype) oper->num2.field, r = 0; \
+		int overflow = 0; \
+		\
+		switch (oper->op) { \
+			case '+': ARITH##_ADD(min, a, b, r, overflow); break; \
+			case '-': ARITH##_SUB(min, a, b, r, overflow); break; \
+			case '*': ARITH##_MUL(min, a, b, r, overflow); break; \
+			case '/': ARITH##_DIV(min, a, b, r, overflow); break; \
+			case EXPR_OP: overflow = execute_##name(oper->code, &r); break; \
+			default: invalid_operator(); \
+		} \
+		oper->num1.field = r; \
+		return checked && overflow; \
+	}
+
+DEFINE_KERNELS(i32, int32_t, i, INT, INT32_MIN, 0)
+DEFINE_KERNELS(i32_checked, int32_t, i, INT, INT32_MIN, 1)
+DEFINE_KERNELS(i64, int64_t, i, INT, INT64_MIN, 0)
+DEFINE_KERNELS(i64_checked, int64_t, i, INT, INT64_MIN, 1)
+DEFINE_KERNELS(f64, double, f, FLT, 0, 0)
+
+/// The kernels of each type, which let integers wrap around
+static const kernel plain_kernels[N_TYPES] = { compute_i32, compute_i64, compute_f64 };
+
+/// The kernels of each type, which detect integer overflows
+static const kernel checked_kernels[N_TYPES] = { compute_i32_checked, compute_i64_checked, compute_f64 };
 
 /**
 	Computes the operations while they are provided by 
@@ -25,8 +130,12 @@ static void compute(operation *oper);
 */
 void* processor_routine(void *arguments) {
 	thread_args *args;
+	operation oper;
+	const kernel *kernels;
+	int overflow;
 	
 	args = (thread_args *) arguments;
+	kernels = args->overflow_check ? checked_kernels : plain_kernels;
 	write_with_int(1, "\tProcessor - Started as #", args->processor_id + 1);
 
 	while(1) {
@@ -36,15 +145,25 @@ void* processor_routine(void *arguments) {
 		mutex_lock(args->mutexA);
 		if (args->oper->op == 'K')
 			break;
+		TRACE_BEGIN(args->trace, "compute", *(args->state));
 		write_with_int(1, "\tOperation received - Processor ", args->processor_id + 1);
-		compute(args->oper);
+		oper = *(args->oper);
+		overflow = kernels[oper.type](args->oper);
+		if (args->cache && !overflow)
+			memo_insert(args->cache, &oper, args->oper->num1);
+		args->store(args->results, *(args->state) - 1, args->oper->num1);
+		if (overflow)
+			write_with_int(2, "\tOverflow in operation #", *(args->state));
+		if (args->status)
+			args->status[*(args->state) - 1] = overflow ? RESULT_OVERFLOW : RESULT_OK;
+		args->finish[*(args->state) - 1] = scheduler_clock();
 		mutex_lock(args->free_cond_mutex);
 		*(args->state) *= -1;
 		*(args->free_count) += 1;
-		if(*args->free_count == 1)
-			cond_signal(args->free_cond);
+		cond_signal(args->free_cond);
 		mutex_unlock(args->free_cond_mutex);
 		write_with_int(1, "\tResult computed. Unblocking main - Processor ", args->processor_id + 1);
+		TRACE_END(args->trace, "compute", -*(args->state));
 		cond_signal(args->ready_cond);
 		mutex_unlock(args->mutexA);
 	}
@@ -55,22 +174,17 @@ void* processor_routine(void *arguments) {
 }
 
 /**
-	Calculates the operation passed and stores the result in
-	the first operand field.
-	@param oper The operation to execute
+	Reports a division by 0 and terminates.
 */
-static void compute(operation *oper) {
-	switch(oper->op) {
-		case '+': oper->num1 = oper->num1 + oper->num2; break;
-		case '-': oper->num1 = oper->num1 - oper->num2; break;
-		case '*': oper->num1 = oper->num1 * oper->num2; break;
-		case '/': if(oper->num2 != 0)
-				oper->num1 = oper->num1 / oper->num2; 
-			  else {
-				write_to_fd(2, "\tDivision by 0\n"); 
-				exit(1);
-			  }; break;
-		default: write_to_fd(2, "\tInvalid operator\n"); 
-			 exit(1); 
-	}
+static void division_by_zero() {
+	write_to_fd(2, "\tDivision by 0\n"); 
+	exit(1);
+}
+
+/**
+	Reports an invalid operator and terminates.
+*/
+static void invalid_operator() {
+	write_to_fd(2, "\tInvalid operator\n"); 
+	exit(1);
 }